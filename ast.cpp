@@ -1,6 +1,11 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <spawn.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <time.h>
@@ -22,6 +27,7 @@
 #include "ct_value-impl.hpp"
 #include "hash-t.hpp"
 #include "syntax-t.hpp"
+#include "profile.hpp"
 
 //#define NO_ELIDE
 
@@ -51,9 +57,9 @@ namespace ast {
   static Exp * just_parse_exp(const Syntax * p, Environ & env, ExpContext c);
 
   CompileWriter::CompileWriter(TargetLang tl) 
-    : target_lang(tl), in_fun(), indent_level(0), deps(), syntax_gather(), 
+    : out_stream(), target_lang(tl), in_fun(), indent_level(0), deps(), syntax_gather(), 
       real_line_num(1), rewrite_level(ExcludeGenerated), local_line_mode(false),
-      used_line_control(false)
+      used_line_control(false), omit_pos(false)
   {
     if (tl == ZLE)
       syntax_gather = new SyntaxGather;
@@ -133,44 +139,59 @@ namespace ast {
       flush_w_line_info();
       local_line_mode = false;
       if (out_stream && used_line_control)
-        buf.printf("#lc %d \"%s\" restore\n", real_line_num+1, ~escaped_file_name);
+        buf << "#lc " << real_line_num+1 << " \"" << escaped_file_name << "\" restore\n";
     } else {
       flush();
     }
   }
 
+  // The file names in positions are shared by the SourceFile so
+  // comparing the pointers first usually avoids comparing the strings
+  static inline bool same_file_name(const String & x, const String & y) {
+    return x.data_obj() == y.data_obj() || x == y;
+  }
+
   void CompileWriter::flush_w_line_info() {
     const Pos & pos = pos_info;
     if (!pos.defined()) {
       flush();
     } else {
-      if (local_file_name() != pos.name || local_line_pos() > pos.line) {
+      if (!same_file_name(local_file_name(), pos.name) || local_line_pos() > pos.line) {
         used_line_control = true;
-        out_stream->printf("#lc %d \"%s\" set\n", pos.line, ~pos.name);
+        *out_stream << "#lc " << pos.line << " \"" << pos.name << "\" set\n";
         real_line_num++;
         lld.name = pos.name;
         lld.line = pos.line;
         lld.pos = real_line_num;
       }
+      static const char NEWLINES[] = "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n";
       unsigned blanks_needed = pos.line - local_line_pos();
       real_line_num += blanks_needed;
-      for (; blanks_needed != 0; --blanks_needed) {
-        out_stream->put('\n');
+      while (blanks_needed != 0) {
+        unsigned n = blanks_needed < sizeof(NEWLINES) - 1 ? blanks_needed : sizeof(NEWLINES) - 1;
+        out_stream->write(NEWLINES, n);
+        blanks_needed -= n;
       }
-      if (!buf.empty()) 
-        for (StringBuf::iterator i = buf.begin(), e = buf.end();;) {
-          if (*i == '\n') {
-            out_stream->put(' ');
-            ++i;
-            while (i != e && asc_isspace(*i))
-              ++i;
-          }
-          if (i == e) break;
-          out_stream->put(*i);
+      // Join everything onto one line by replacing each newline and
+      // the whitespace after it with a single space.  This is done in
+      // place, a span at a time, so the result can be written in one
+      // go.
+      char * o = buf.begin();
+      for (const char * i = o, * e = buf.end(); i != e;) {
+        const char * nl = (const char *)memchr(i, '\n', e - i);
+        const char * stop = nl ? nl : e;
+        memmove(o, i, stop - i);
+        o += stop - i;
+        i = stop;
+        if (!nl) break;
+        *o++ = ' ';
+        ++i;
+        while (i != e && asc_isspace(*i))
           ++i;
-        }
+      }
+      out_stream->write(buf.begin(), o - buf.begin());
       buf.clear();
-      out_stream->printf("# %u\n", pos.line);
+      *out_stream << "# " << pos.line << '\n';
       //out_stream->put('\n');
       real_line_num++;
     }
@@ -199,12 +220,16 @@ namespace ast {
   }
 
   bool CompileWriter::set_line_info(const SourceStr & str) {
+    if (omit_pos) {
+      pos_info.clear();
+      return false;
+    }
     if (local_line_mode) {
       if (!str.source) return false;
       const SourceFile * sf = str.source->file();
       if (!sf) return false;
       Pos new_pos = sf->get_pos(str.begin);
-      if (new_pos.name != pos_info.name || new_pos.line != pos_info.line) {
+      if (new_pos.line != pos_info.line || !same_file_name(new_pos.name, pos_info.name)) {
         flush_w_line_info();
       }
       pos_info = new_pos;
@@ -239,6 +264,68 @@ namespace ast {
     FStream * f = new FStream();
     f->open(str, mode);
     out_stream = f;
+    set_file_name(str);
+  }
+
+  void CompileWriter::open(ParmStr str, OStream * out) {
+    out_stream = out;
+    set_file_name(str);
+  }
+
+  // Writes everything to two streams, owns both.
+  struct TeeStream : public OStream {
+    OStream * a;
+    OStream * b;
+    TeeStream(OStream * a0, OStream * b0) : a(a0), b(b0) {}
+    ~TeeStream() {delete a; delete b;}
+    void write(char c) {a->write(c); b->write(c);}
+    void write(ParmStr str) {a->write(str); b->write(str);}
+    void write(const void * data, unsigned int size) {a->write(data, size); b->write(data, size);}
+    int vprintf(const char * format, va_list ap) {
+      StringBuf buf;
+      int res = buf.vprintf(format, ap);
+      write(buf.data(), buf.size());
+      return res;
+    }
+  };
+
+  pid_t CompileWriter::open_pipe(ParmStr str, const char * const argv[], bool save) {
+    int fds[2];
+    if (pipe(fds) == -1) {
+      fprintf(stderr, "ERROR: unable to create pipe: %s\n", strerror(errno));
+      abort();
+    }
+    // Don't let anything else spawned hold the pipe open, the child
+    // gets the read end as stdin via dup2 which clears the flag
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, fds[0], STDIN_FILENO);
+    pid_t pid;
+    int res = posix_spawnp(&pid, argv[0], &actions, NULL, (char * const *)argv, environ);
+    posix_spawn_file_actions_destroy(&actions);
+    ::close(fds[0]);
+    if (res != 0) {
+      fprintf(stderr, "ERROR: unable to run %s: %s\n", argv[0], strerror(res));
+      abort();
+    }
+    out_stream = new FStream(fdopen(fds[1], "w"));
+    if (save) {
+      FStream * f = new FStream();
+      f->open(str, "w");
+      out_stream = new TeeStream(out_stream, f);
+    }
+    set_file_name(str);
+    return pid;
+  }
+
+  void CompileWriter::open_binary(ParmStr str) {
+    open(str, "wb");
+    out_stream = new parse_parse::BinaryWriter(out_stream);
+  }
+
+  void CompileWriter::set_file_name(ParmStr str) {
     StringBuf lbuf;
     const char * s = str;
     while (*s) escape(lbuf, *s++);
@@ -256,9 +343,9 @@ namespace ast {
 
   void CompileWriter::flush() {
     if (out_stream) {
-      for (const char * i = buf.data(), * e = buf.data_end(); i != e; ++i) {
-        if (*i == '\n') real_line_num++;
-      }
+      const char * e = buf.data_end();
+      for (const char * i = buf.data(); i != e && (i = (const char *)memchr(i, '\n', e - i)); ++i)
+        real_line_num++;
       out_stream->write(buf.data(), buf.size());
       buf.clear();
     }
@@ -456,6 +543,12 @@ namespace ast {
   }
 
   void parse_stmts_raw(SourceStr str, Environ & env) {
+    if (parse_parse::is_binary(str)) {
+      parse_parse::BinaryReader r(str);
+      while (!r.empty())
+        parse_stmt_part(r.parse(), env);
+      return;
+    }
     while (!str.empty()) {
       parse_parse::Res r = parse_parse::parse(str);
       parse_stmt_part(r.parse, env);
@@ -469,11 +562,94 @@ namespace ast {
     parse_stmts(p->args_begin(), p->args_end(), env);
   }
 
+  //
+  // Incremental compilation cache, enabled with ZL_CACHE_DIR.
+  //
+  // The emitted body of a function is stored under a key made from a
+  // fingerprint of everything parsed before the top-level statement
+  // it is in, the text of that statement and the function's name.
+  // Bodies that did not add any top-level symbols are left out of the
+  // fingerprint, so editing one does not invalidate the functions
+  // after it.  On a hit the body is not parsed, the deps are looked up
+  // by name and the stored text is emitted instead.  Cached bodies
+  // are always emitted without line information so the output does
+  // not depend on what was in the cache.
+  //
+
+  static const unsigned long long FNV_OFFSET = 14695981039346656037ULL;
+
+  static inline unsigned long long fnv_mix(unsigned long long h, const char * i, const char * e) {
+    for (; i != e; ++i) {
+      h ^= (unsigned char)*i;
+      h *= 1099511628211ULL;
+    }
+    return h;
+  }
+
+  struct CacheStmt;
+
+  struct BodyCache {
+    String dir;
+    unsigned long long fingerprint;
+    CacheStmt * stmt; // innermost top-level statement being parsed
+    hash_map<String, const TopLevelVarDecl *> by_name;
+    SymbolNode * indexed; // symbols from here on are in by_name
+    BodyCache(String d) : dir(d), fingerprint(FNV_OFFSET), stmt(), indexed() {}
+  };
+
+  static BodyCache * body_cache = NULL;
+
+  // Only the zl program enables the cache (see main.cpp), so the
+  // executable is the compiler.
+  void enable_body_cache(ParmStr dir, ParmStr opts) {
+    mkdir(dir, 0777);
+    body_cache = new BodyCache(dir.str());
+    body_cache->fingerprint = fnv_mix(body_cache->fingerprint, opts, opts.str() + opts.size());
+    cache_note_input("/proc/self/exe");
+  }
+
+  void cache_note_input(ParmStr file) {
+    if (!body_cache) return;
+    struct stat st;
+    StringBuf buf;
+    buf << file;
+    if (stat(file, &st) == 0)
+      buf.printf(" %llu %llu", (unsigned long long)st.st_size, (unsigned long long)st.st_mtime);
+    body_cache->fingerprint = fnv_mix(body_cache->fingerprint, buf.begin(), buf.end());
+  }
+
+  struct CacheStmt {
+    SourceStr text;
+    CacheStmt * prev;
+    Vector<SourceStr> skip; // bodies to leave out of the fingerprint
+    bool no_skip;        // a body added top-level symbols
+    CacheStmt(const Syntax * p) : text(p->str()), prev(), no_skip(false) {
+      if (!body_cache) return;
+      prev = body_cache->stmt;
+      body_cache->stmt = this;
+    }
+    ~CacheStmt() {
+      if (!body_cache) return;
+      body_cache->stmt = prev;
+      unsigned long long h = body_cache->fingerprint;
+      const char * i = text.begin;
+      if (no_skip) skip.clear();
+      for (Vector<SourceStr>::const_iterator s = skip.begin(), e = skip.end(); s != e; ++s) {
+        if (s->begin < i || s->end > text.end) continue;
+        h = fnv_mix(h, i, s->begin);
+        h = fnv_mix(h, "{}", "{}" + 2);
+        i = s->end;
+      }
+      body_cache->fingerprint = fnv_mix(h, i, text.end);
+    }
+  };
+
   void parse_stmts(SourceStr str, Environ & env) {
     parse_prod("SPACING", str, ParseInfo(env.peg));
     while (!str.empty()) {
       const Syntax * p = parse_prod("STMT", str, ParseInfo(env.peg), &env); 
-     parse_stmt_part(p, env);
+      CacheStmt cs(p);
+      parse_stmt_part(p, env);
     }
   }
 
@@ -778,7 +954,7 @@ namespace ast {
     mutable unsigned num;
     NormalLabel() : num() {}
     bool uniq_name(OStream & o, bool) const {
-      o.printf("%s$$%u", ~name(), num);
+      o << name() << "$$" << num;
       return num != NPOS;
     }
     SymbolNode * add_to_env(const SymbolKey & k, Environ &, bool shadow_ok);
@@ -799,7 +975,7 @@ namespace ast {
     LocalLabel() : num() {}
     using Label::uniq_name;
     bool uniq_name(OStream & o, bool) const {
-      o.printf("%s$%u", ~name(), num);
+      o << name() << '$' << num;
       return num != NPOS;
     }
     void make_unique(SymbolNode * self, SymbolNode * stop) const {
@@ -998,6 +1174,7 @@ namespace ast {
     const TopLevelVarDecl * tl = sym->top_level();
     if (tl && env.deps) {
       String un = tl->uniq_name();
+      env.deps->insert(tl);
       if (un == "zl_malloc") {
         env.deps->insert(find_overloaded_symbol<TopLevelVarDecl>(NULL, NULL, env.find_tls("malloc"), NULL));
         assert(env.deps->back());
@@ -1007,9 +1184,14 @@ namespace ast {
       } else if (un == "zl_free") {
         env.deps->insert(find_overloaded_symbol<TopLevelVarDecl>(NULL, NULL, env.find_tls("free"), NULL));
         assert(env.deps->back());
-      } else {
-        env.deps->insert(tl);
       }
+    } else if (env.deps) {
+      // an overloaded name that is not resolved (for example in an
+      // initializer list) may refer to any of the overloads
+      for (const OverloadedSymbol * o = dynamic_cast<const OverloadedSymbol *>(sym); o; o = o->next)
+        if (const VarSymbol * v = dynamic_cast<const VarSymbol *>(o->sym))
+          if (const TopLevelVarDecl * d = v->top_level())
+            env.deps->insert(d);
     }
     if (sym->ct_value)
       ct_value_ = sym->ct_value;
@@ -1126,6 +1308,44 @@ namespace ast {
     }
   };
 
+  // A function body taken from the incremental compilation cache.
+  // The cached text is only good for a plain .zls; for anything
+  // else the body is parsed on demand.
+  struct CachedBlock : public Block {
+    String text;
+    Environ * env;
+    Block * parsed;
+    CachedBlock(const Syntax * p, String t, Environ & e) 
+      : text(t), env(new Environ(e)), parsed() {syn = p;}
+    Block * realize() {
+      if (!parsed) {
+        Deps deps;
+        env->deps = &deps;
+        parsed = dynamic_cast<Block *>(parse_stmt(syn, *env));
+        assert(parsed);
+        FinalizeEnviron fenv;
+        fenv.fun_symbols = env->symbols.front;
+        parsed->finalize(fenv);
+      }
+      return parsed;
+    }
+    void compile_prep(CompileEnviron & e) {
+      if (parsed || e.for_macro_sep_c)
+        realize()->compile_prep(e);
+    }
+    void compile(CompileWriter & f) {
+      if (f.target_lang == CompileWriter::ZLS && !f.for_compile_time() && !f.for_macro_sep_c) {
+        f << text;
+      } else {
+        if (!parsed) {
+          CompileEnviron e;
+          realize()->compile_prep(e);
+        }
+        f << parsed;
+      }
+    }
+  };
+
   struct BlockBuilder {
     Block * block;
     Environ env;
@@ -1185,7 +1405,7 @@ namespace ast {
       if (num == 0)
         o << name();
       else
-        o.printf("%s$%u", ~name(), num);
+        o << name() << '$' << num;
       return num != NPOS;
     }
     void make_unique(SymbolNode * self, SymbolNode * stop) const {
@@ -1590,7 +1810,7 @@ namespace ast {
         f << cleanup;
     }
     bool uniq_name(OStream & o, bool) const {
-      o.printf("%s$%u", ~name(), num);
+      o << name() << '$' << num;
       return true;
     }
     void make_unique(SymbolNode * self, SymbolNode * stop) const {
@@ -1603,15 +1823,13 @@ namespace ast {
   }
 
 
-  static unsigned last_temp_num = 0;
-
   struct TempBase : public AutoVar {
     bool uniq_name(OStream & o, bool) const {
-      o.printf("%s$t%u", ~name(), num);
+      o << name() << "$t" << num;
       return true;
     }
     void make_unique(SymbolNode *, SymbolNode *) const {
-      num = last_temp_num++;
+      num = uniq_counters.temp++;
     }
   };
 
@@ -1726,10 +1944,10 @@ namespace ast {
   };
 
   static StorageClass get_storage_class(const Syntax * p) {
-    if (p->flag("auto")) return SC_AUTO;
-    if (p->flag("static")) return SC_STATIC;
-    if (p->flag("extern")) return SC_EXTERN;
-    if (p->flag("register")) return SC_REGISTER;
+    if (p->flag(FLAG_AUTO)) return SC_AUTO;
+    if (p->flag(FLAG_STATIC)) return SC_STATIC;
+    if (p->flag(FLAG_EXTERN)) return SC_EXTERN;
+    if (p->flag(FLAG_REGISTER)) return SC_REGISTER;
     return SC_NONE;
   }
 
@@ -1758,7 +1976,7 @@ namespace ast {
     const Syntax * name_p = p->arg(0);
     SymbolKey name = expand_binding(name_p, env);
     StorageClass storage_class = get_storage_class(p);
-    bool shadow = p->flag("__shadow") || p->flag("shadow");
+    bool shadow = p->flag(FLAG__SHADOW) || p->flag(FLAG_SHADOW);
     //bool shadow = true;
     if (shadow && collect) throw unknown_error(p);
     Var * var;
@@ -3226,7 +3444,7 @@ namespace ast {
     Collect collect;
     Parse<TopLevel> prs;
     bool do_finalize;
-    const SourceStr & source_str() const {return name->str();} // FIXME: This isn't quite right
+    SourceStr source_str() const {return name->str();} // FIXME: This isn't quite right
     void add_syntax(const Syntax * p) {
       //printf("ADD SYNTAX: %s\n", ~p->to_string());
       parse_ast_node<TopLevel>(p, *lenv, this);
@@ -3359,7 +3577,7 @@ namespace ast {
   Stmt * parse_module(const Syntax * p, Environ & env) {
     assert_num_args(p, 1, 2);
     ModuleBuilder * m = new ModuleBuilder(p->arg(0), env);
-    if (p->flag("asm_hidden"))
+    if (p->flag(FLAG_ASM_HIDDEN))
       m->module->asm_hidden = true;
     if (p->num_args() > 1)
       m->parse_body(p->arg(1));
@@ -3466,7 +3684,7 @@ namespace ast {
   Stmt * parse_import(const Syntax * p, Environ & env) {
     //assert_num_args(p, 1);
     GatherMarks gather;
-    bool same_scope = p->flag("same_scope");
+    bool same_scope = p->flag(FLAG_SAME_SCOPE);
     const Syntax * id = expand_id(p->arg(0), env);
     const Module * m = lookup_symbol<Module>(id, OUTER_NS, env.symbols.front, NULL, 
                                              NormalStrategy, gather);
@@ -3546,7 +3764,7 @@ namespace ast {
       env.mangle = false;
       env.abi_info = &DEFAULT_ABI_INFO;
     } else if (val->eq("C++")) {
-      const Syntax * abi_info_name = p->flag("abi");
+      const Syntax * abi_info_name = p->flag(FLAG_ABI);
       if (abi_info_name) {
         
         //fprintf(stderr, "WILL USE ABI %s\n", ~abi_info_name->arg(0)->to_string());
@@ -3650,7 +3868,7 @@ namespace ast {
 
   Stmt * parse_declare_user_type(const Syntax * p, Environ & env, DeclHandle ** handle) {
     assert_num_args(p, 1);
-    bool outer = p->flag("outer");
+    bool outer = p->flag(FLAG_OUTER);
     if (outer && !dynamic_cast<const Module *>(env.where))
       outer = false;
     //if (p && outer)
@@ -3876,14 +4094,10 @@ namespace ast {
       printf("SKIPPING (already included): %s\n", ~file_name);
       return;
     }
-    clock_t start = clock();
+    TimePhase phase("include");
     printf("INCLUDING: %s\n", ~file_name);
     SourceFile * code = new_source_file(file_name);
     parse_stmts(SourceStr(code), env);
-    clock_t parse_done = clock();
-    clock_t load_done = clock();
-    printf("Include Time (%s): %f  (parse: %f)\n", ~file_name,
-           (load_done - start)/1000000.0, (parse_done - start)/1000000.0);
     imf = new ImportedFile(true);
     env.add(file_id, imf);
   }
@@ -3908,7 +4122,7 @@ namespace ast {
         return;
       }
     }
-    clock_t start = clock();
+    TimePhase phase("import");
     bool env_interface_orig = env.interface;
     if (SubStr(file_name.end()-12,file_name.end()) != "/prelude.zlh") {
       printf("IMPORTING: %s\n", ~file_name);
@@ -3922,7 +4136,6 @@ namespace ast {
         throw;
       }
     }
-    clock_t parse_done = clock();
     env.interface = env_interface_orig;
     const char * dot = strrchr(~file_name, '.');
     StringBuf buf;
@@ -3936,9 +4149,6 @@ namespace ast {
     if (res == 0) {
       load_macro_lib(~lib_fn, env);
     }
-    clock_t load_done = clock();
-    printf("Import Time (%s): %f  (parse: %f)\n", ~file_name, 
-           (load_done - start)/1000000.0, (parse_done - start)/1000000.0);
     imf = new ImportedFile();
     env.add(file_id, imf);
   }
@@ -4149,7 +4359,7 @@ namespace ast {
     //  assert(name.name == s->name());
     bool previous_declared = f;
     if (previous_declared) {
-      if (p->num_args() > 3)
+      if (fun_syn_has_body(p))
         f->parse_forward_i(p, env, collect);
     } else {
       f = new Fun;
@@ -4220,22 +4430,22 @@ namespace ast {
 
     //printf("PARSING FLAGS OF %s\n", ~p->to_string());
     inline_ = false;
-    if (p->flag("inline")) inline_ = true;
+    if (p->flag(FLAG_INLINE)) inline_ = true;
     ct_callback = false;
-    if (p->flag("__ct_callback")) ct_callback = true;
+    if (p->flag(FLAG_CT_CALLBACK)) ct_callback = true;
     for_ct_ = ct_callback;
-    if (p->flag("__for_ct")) for_ct_ = true;
+    if (p->flag(FLAG_FOR_CT)) for_ct_ = true;
     deps_closed = ct_callback;
     static_constructor = false;
-    if (p->flag("__static_constructor")) static_constructor = true;
-    if (p->flag("__constructor__")) static_constructor = true;
+    if (p->flag(FLAG_STATIC_CONSTRUCTOR)) static_constructor = true;
+    if (p->flag(FLAG_CONSTRUCTOR)) static_constructor = true;
 
     mangle = !ct_callback && env0.mangle;
     if (env0.where == NULL && p->arg(0)->eq("main")) mangle = false;
     if (mangle && env0.abi_info->mangler)
       mangler = env0.abi_info->mangler;
 
-    if (p->flag("__need_snapshot")) {
+    if (p->flag(FLAG_NEED_SNAPSHOT)) {
       env_ss = *env0.top_level_environ;
     }
 
@@ -4264,7 +4474,7 @@ namespace ast {
     type = env.function_sym()->inst(env.types, this);
 
     body = 0;
-    if (!env.interface && p->num_args() > 3) {
+    if (!env.interface && fun_syn_has_body(p)) {
       if (collect) {
         //IOUT.printf("Adding to collect for %p %s\n", this, ~p->to_string());
         collect->second_pass.add(new CollectParseDef(this, env0));
@@ -4278,8 +4488,80 @@ namespace ast {
     return this;
   }
 
+  static String body_cache_file(String key) {
+    StringBuf buf;
+    buf << body_cache->dir << '/' << key << ".zlc";
+    return buf.freeze();
+  }
+
+  static const TopLevelVarDecl * find_by_uniq_name(String name, Environ & env) {
+    SymbolNode * front = *env.top_level_symbols->front;
+    for (SymbolNode * cur = front; cur && cur != body_cache->indexed; cur = cur->next) {
+      if (cur->alias()) continue;
+      const TopLevelVarDecl * d = dynamic_cast<const TopLevelVarDecl *>(cur->value);
+      if (d && d->num != NPOS && !body_cache->by_name.have(d->uniq_name()))
+        body_cache->by_name.insert(d->uniq_name(), d);
+    }
+    body_cache->indexed = front;
+    hash_map<String, const TopLevelVarDecl *>::const_iterator i = body_cache->by_name.find(name);
+    return i != body_cache->by_name.end() ? i->second : NULL;
+  }
+
+  // Entry format: "ZLC1\n", the number of deps, one uniq name per
+  // line, then the body text.
+  static bool read_cached_body(String key, Environ & env, Deps & deps, String & text) {
+    FILE * f = fopen(body_cache_file(key), "r");
+    if (!f) return false;
+    StringBuf buf;
+    char tmp[8192];
+    size_t n;
+    while ((n = fread(tmp, 1, sizeof(tmp), f)) > 0)
+      buf.append(tmp, n);
+    fclose(f);
+    const char * i = buf.begin(), * e = buf.end();
+    if (e - i < 5 || memcmp(i, "ZLC1\n", 5) != 0) return false;
+    i += 5;
+    char * end;
+    unsigned num = strtoul(i, &end, 10);
+    if (end == i || end == e || *end != '\n') return false;
+    i = end + 1;
+    Deps res;
+    for (unsigned j = 0; j != num; ++j) {
+      const char * nl = (const char *)memchr(i, '\n', e - i);
+      if (!nl) return false;
+      const TopLevelVarDecl * d = find_by_uniq_name(String(i, nl), env);
+      if (!d) return false;
+      res.push_back(d);
+      i = nl + 1;
+    }
+    deps = res;
+    text = String(i, e);
+    return true;
+  }
+
+  static void write_cached_body(String key, const Deps & deps, String text) {
+    StringBuf buf;
+    buf << "ZLC1\n" << (unsigned)deps.size() << "\n";
+    for (Deps::const_iterator i = deps.begin(), e = deps.end(); i != e; ++i) {
+      if (!*i || (*i)->num == NPOS) return;
+      buf << (*i)->uniq_name() << "\n";
+    }
+    buf << text;
+    String file = body_cache_file(key);
+    StringBuf tmp;
+    tmp << file << ".tmp" << (unsigned)getpid();
+    String tmp_file = tmp.freeze();
+    FILE * f = fopen(tmp_file, "w");
+    if (!f) return;
+    bool ok = fwrite(buf.data(), 1, buf.size(), f) == buf.size();
+    if (fclose(f) == 0 && ok)
+      rename(tmp_file, file);
+    else
+      unlink(tmp_file);
+  }
+
   Stmt * Fun::finish_parse(Environ & env0) {
-    assert(syn->num_args() > 3);
+    assert(fun_syn_has_body(syn));
 
     if (storage_class != SC_STATIC)
       link_once = env0.link_once;
@@ -4300,9 +4582,43 @@ namespace ast {
       //env.symbols.add(n, sym);
     }
 
+    CacheStmt * cs = body_cache ? body_cache->stmt : NULL;
+    SourceStr body_str = syn->arg(3)->str();
+    if (cs && cs->text.source && body_str.source 
+        && body_str.begin >= cs->text.begin && body_str.end <= cs->text.end) 
+    {
+      StringBuf buf;
+      unsigned long long h = fnv_mix(body_cache->fingerprint, cs->text.begin, cs->text.end);
+      String un = uniq_name();
+      buf.printf("%016llx", fnv_mix(h, un.begin(), un.end()));
+      cache_key = buf.freeze();
+      String text;
+      if (read_cached_body(cache_key, env, deps_, text)) {
+        cache_key = String();
+        body = new CachedBlock(syn->arg(3), text, env);
+        env.add_defn(this);
+        symbols = env.symbols;
+        cs->skip.push_back(body_str);
+        return empty_stmt();
+      }
+    }
+
+    SymbolNode * syms_before = *env.top_level_symbols->front;
+    Stmt * defns_before = env.top_level_symbols->last;
+
     body = dynamic_cast<Block *>(parse_stmt(syn->arg(3), env));
     assert(body); // FiXME
 
+    if (cache_key.defined()) {
+      if (*env.top_level_symbols->front == syms_before && env.top_level_symbols->last == defns_before
+          && !for_ct_ && !env_ss && !is_macro) {
+        cs->skip.push_back(body_str);
+      } else {
+        cs->no_skip = true;
+        cache_key = String();
+      }
+    }
+
     // fix up order_num so the function body will come after any top
     // level symbols which where created in the local env
     env.add_defn(this);
@@ -4359,7 +4675,20 @@ namespace ast {
     f.end_line();
     if (body && phase != Forward) {
       f.in_fun = this;
-      f << adj_indent(2) << body;
+      if (cache_key.defined() && f.target_lang == CompileWriter::ZLS 
+          && !f.for_compile_time() && !f.for_macro_sep_c) {
+        if (!cached_body.defined()) {
+          CompileWriter w(f.target_lang);
+          w.omit_pos = true;
+          w.in_fun = this;
+          w << adj_indent(2) << body;
+          cached_body = w.buf.freeze();
+          write_cached_body(cache_key, deps_, cached_body);
+        }
+        f << cached_body;
+      } else {
+        f << adj_indent(2) << body;
+      }
       f.in_fun = NULL;
     }
     f << ")\n";
@@ -4752,7 +5081,7 @@ namespace ast {
     //type_name << "struct " << what();
     //if (s->members.empty())
     //  fprintf(stderr, "Warning: %s\n", error(p, "Empty Struct Currently Unsupported")->message().c_str());
-    if (p->flag("bit-field")) {
+    if (p->flag(FLAG_BIT_FIELD)) {
       printf("WARNING: Bit Fields not supported in %s\n", ~name->to_string());
       decl->bit_field = true;
     }
@@ -5632,7 +5961,244 @@ namespace ast {
     cw << "\") ";
   }
 
+  //
+  // If ZL_EMIT_JOBS > 1 definitions are emitted in chunks of
+  // EMIT_CHUNK_SIZE declarations by worker processes.  The line
+  // tracking state is reset at the start of every chunk but the first
+  // so that the output of a chunk does not depend on the chunks before
+  // it, and so the result is the same no matter how many workers are
+  // used.  Otherwise, or when writing the macro library (which keeps
+  // state in for_macro_sep_c), the definitions are emitted in one go.
+  //
+
+  typedef Vector<const TopLevelVarDecl *> VarDefns;
+
+  static const unsigned EMIT_CHUNK_SIZE = 256;
+
+  static unsigned emit_jobs() {
+    const char * s = getenv("ZL_EMIT_JOBS");
+    long n = s ? strtol(s, NULL, 10) : 1;
+    return n > 0 ? n : 1;
+  }
+
+  static void start_chunk(CompileWriter & cw) {
+    cw.flush();
+    cw.lld = LastLineDirective();
+    cw.used_line_control = false;
+  }
+
+  static void emit_chunk(CompileWriter & cw, const VarDefns & defns, unsigned chunk) {
+    unsigned i = chunk * EMIT_CHUNK_SIZE;
+    unsigned e = std::min(i + EMIT_CHUNK_SIZE, (unsigned)defns.size());
+    for (; i != e; ++i)
+      defns[i]->compile(cw, Declaration::Body);
+  }
+
+  // Emit a chunk into a string as if it started on line 1.
+  static String emit_chunk_alone(const CompileWriter & cw, const VarDefns & defns, unsigned chunk) {
+    CompileWriter w(cw.target_lang);
+    StringBuf * out = new StringBuf;
+    w.out_stream = out;
+    w.escaped_file_name = cw.escaped_file_name;
+    w.rewrite_level = cw.rewrite_level;
+    emit_chunk(w, defns, chunk);
+    w.flush();
+    String res = out->freeze();
+    w.out_stream = NULL;
+    delete out;
+    return res;
+  }
+
+  // Append a chunk created by emit_chunk_alone, the line numbers in
+  // the "#lc N "file" restore" directives are absolute so they need
+  // to be adjusted.
+  static void append_chunk(CompileWriter & cw, String text) {
+    static const char RESTORE[] = "\" restore\n";
+    static const unsigned RESTORE_LEN = sizeof(RESTORE) - 1;
+    cw.flush();
+    unsigned offset = cw.real_line_num - 1;
+    const char * i = text.begin(), * e = text.end();
+    const char * r;
+    while ((r = (const char *)memmem(i, e - i, RESTORE, RESTORE_LEN))) {
+      const char * line = r;
+      while (line != i && line[-1] != '\n') --line;
+      if (e - line > 4 && memcmp(line, "#lc ", 4) == 0) {
+        char * num_end;
+        unsigned long n = strtoul(line + 4, &num_end, 10);
+        cw.buf.append(i, line + 4 - i);
+        cw.buf.append_uint(n + offset);
+        i = num_end;
+      }
+      cw.buf.append(i, r + RESTORE_LEN - i);
+      i = r + RESTORE_LEN;
+    }
+    cw.buf.append(i, e - i);
+    cw.flush();
+  }
+
+  static bool write_all(int fd, const void * data, size_t size) {
+    const char * p = (const char *)data;
+    while (size > 0) {
+      ssize_t n = write(fd, p, size);
+      if (n == -1 && errno == EINTR) continue;
+      if (n <= 0) return false;
+      p += n;
+      size -= n;
+    }
+    return true;
+  }
+
+  struct EmitChunkHeader {
+    unsigned chunk;
+    unsigned size;
+  };
+
+  struct EmitWorker {
+    pid_t pid;
+    int fd;
+    StringBuf data;
+  };
+
+  // Chunk 0 is emitted by the parent while the workers emit the rest,
+  // worker W sends chunks 1+W, 1+W+JOBS, ... down a pipe.  Any chunk
+  // that did not make it back is emitted by the parent.
+  static void emit_defns_parallel(CompileWriter & cw, const VarDefns & defns, unsigned jobs) {
+    unsigned num_chunks = (defns.size() + EMIT_CHUNK_SIZE - 1) / EMIT_CHUNK_SIZE;
+    if (jobs > num_chunks - 1) jobs = num_chunks - 1;
+
+    Vector<EmitWorker *> workers;
+    for (unsigned w = 0; w != jobs; ++w) {
+      int fds[2];
+      if (pipe(fds) == -1) break;
+      pid_t pid = fork();
+      if (pid == -1) {
+        close(fds[0]);
+        close(fds[1]);
+        break;
+      }
+      if (pid == 0) {
+        close(fds[0]);
+        for (unsigned c = 1 + w; c < num_chunks; c += jobs) {
+          String text = emit_chunk_alone(cw, defns, c);
+          EmitChunkHeader h = {c, text.size()};
+          if (!write_all(fds[1], &h, sizeof(h)) || !write_all(fds[1], text.begin(), text.size()))
+            _exit(1);
+        }
+        _exit(0);
+      }
+      close(fds[1]);
+      EmitWorker * worker = new EmitWorker;
+      worker->pid = pid;
+      worker->fd = fds[0];
+      workers.push_back(worker);
+    }
+
+    emit_chunk(cw, defns, 0);
+
+    Vector<struct pollfd> pfds;
+    for (unsigned w = 0; w != workers.size(); ++w) {
+      struct pollfd pfd = {workers[w]->fd, POLLIN, 0};
+      pfds.push_back(pfd);
+    }
+    unsigned open_fds = pfds.size();
+    while (open_fds > 0) {
+      if (poll(pfds.data(), pfds.size(), -1) == -1) {
+        if (errno == EINTR) continue;
+        break;
+      }
+      for (unsigned w = 0; w != pfds.size(); ++w) {
+        if (pfds[w].fd == -1 || !pfds[w].revents) continue;
+        char tmp[16384];
+        ssize_t n = read(pfds[w].fd, tmp, sizeof(tmp));
+        if (n == -1 && errno == EINTR) continue;
+        if (n > 0) {
+          workers[w]->data.append(tmp, n);
+        } else {
+          close(pfds[w].fd);
+          pfds[w].fd = -1;
+          --open_fds;
+        }
+      }
+    }
+
+    Vector<String> texts(num_chunks);
+    for (unsigned w = 0; w != workers.size(); ++w) {
+      EmitWorker * worker = workers[w];
+      if (pfds[w].fd != -1) close(pfds[w].fd);
+      int status;
+      pid_t res;
+      while ((res = waitpid(worker->pid, &status, 0)) == -1 && errno == EINTR);
+      // a chunk without text is emitted here instead
+      if (res == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) continue;
+      const char * i = worker->data.data(), * e = worker->data.data_end();
+      EmitChunkHeader h;
+      while ((size_t)(e - i) >= sizeof(h)) {
+        memcpy(&h, i, sizeof(h));
+        i += sizeof(h);
+        if (h.chunk >= num_chunks || (size_t)(e - i) < h.size) break;
+        texts[h.chunk] = String(i, i + h.size);
+        i += h.size;
+      }
+    }
+
+    for (unsigned c = 1; c < num_chunks; ++c) {
+      start_chunk(cw);
+      if (texts[c].defined())
+        append_chunk(cw, texts[c]);
+      else
+        emit_chunk(cw, defns, c);
+    }
+  }
+
+  static void emit_defns(CompileWriter & cw, const VarDefns & defns) {
+    unsigned num_chunks = (defns.size() + EMIT_CHUNK_SIZE - 1) / EMIT_CHUNK_SIZE;
+    unsigned jobs = emit_jobs();
+    if (jobs > 1 && num_chunks > 1 && cw.out_stream && !cw.for_compile_time()
+        && !cw.for_macro_sep_c && cw.target_lang == CompileWriter::ZLS)
+      return emit_defns_parallel(cw, defns, jobs);
+    for (VarDefns::const_iterator i = defns.begin(), e = defns.end(); i != e; ++i)
+      (*i)->compile(cw, Declaration::Body);
+  }
+
+  //
+  // Only the top-level variables and functions reachable from a root
+  // are emitted.  The roots are the definitions visible outside of the
+  // translation unit and anything run at startup or exit.  Reachability
+  // follows the deps recorded while parsing, type references are not
+  // tracked so all types are still emitted.  Setting ZL_KEEP_DECLS
+  // disables this.
+  //
+
+  typedef hash_set<const TopLevelVarDecl *> LiveDecls;
+
+  static bool keep_all_decls() {
+    return getenv("ZL_KEEP_DECLS");
+  }
+
+  static bool is_root(const TopLevelVarDecl * var) {
+    if (const Fun * f = dynamic_cast<const Fun *>(var)) {
+      if (!f->body) return false;
+      if (f->static_constructor) return true;
+    } else if (const TopLevelVar * v = dynamic_cast<const TopLevelVar *>(var)) {
+      if (v->constructor || v->cleanup) return true;
+    }
+    return var->storage_class != SC_STATIC && !var->link_once;
+  }
+
+  static void mark_live(const TopLevelVarDecl * root, LiveDecls & live) {
+    Vector<const TopLevelVarDecl *> todo;
+    todo.push_back(root);
+    while (!todo.empty()) {
+      const TopLevelVarDecl * d = todo.back();
+      todo.pop_back();
+      if (!d || !live.insert(d).second) continue;
+      // walk deps_ directly, the closure may be incomplete for cycles
+      todo.insert(todo.end(), d->deps_.begin(), d->deps_.end());
+    }
+  }
+
   void compile(TopLevelSymbolTable * tls, CompileWriter & cw) {
+    TraceScope trace("emit", "compile");
 
     SymbolNode * syms = *tls->front;
     Stmt * defns = tls->first;
@@ -5659,6 +6225,18 @@ namespace ast {
     Others others;
     //Others other_defns;
 
+    LiveDecls * live = NULL;
+    if (cw.target_lang == CompileWriter::ZLS && !cw.for_compile_time() 
+        && !cw.for_macro_sep_c && !keep_all_decls()) 
+    {
+      live = new LiveDecls;
+      for (Stmt * cur = defns; cur; cur = cur->next) {
+        VarP var = dynamic_cast<VarP>(cur);
+        if (var && !var->for_ct() && is_root(var))
+          mark_live(var, *live);
+      }
+    }
+
     for (SymbolNode * cur = syms; cur; cur = cur->next) {
       if (cur->should_skip())
         continue;
@@ -5679,7 +6257,7 @@ namespace ast {
             use_var = true;
           }
         } else if (cw.for_macro_sep_c || !var->for_ct()) {
-          use_var = true;
+          use_var = !live || live->have(var);
         }
         if (use_var) {
           vars.push_back(var);
@@ -5720,7 +6298,8 @@ namespace ast {
             var_defns.push_back(var);
           }
         } else if (cw.for_macro_sep_c || !var->for_ct()) {
-          var_defns.push_back(var);
+          if (!live || live->have(var))
+            var_defns.push_back(var);
         }
         continue;
       }
@@ -5850,10 +6429,7 @@ namespace ast {
 
     sep(cw, "definitions");
 
-    for (VarsItr i = var_defns.begin(), e = var_defns.end(); i != e; ++i) {
-      //printf("COMPILE %s %d\n", ~(*i)->uniq_name(), (*i)->order_num);
-      (*i)->compile(cw, Declaration::Body);
-    }
+    emit_defns(cw, var_defns);
 
     sep(cw, "special");
 
@@ -72,6 +72,7 @@ namespace ast {
     SourceStr outer_span;
     bool local_line_mode;
     bool used_line_control;
+    bool omit_pos; // don't track source positions, for cached bodies
     LastLineDirective lld;
     Pos pos_info;
     void enter_local_line_mode(const Syntax *);
@@ -105,6 +106,15 @@ namespace ast {
     operator OStream & () {return buf;}
 
     void open(ParmStr str, const char * mode);
+    // Write the output to OUT, which the writer takes ownership of,
+    // STR is only used in line directives.
+    void open(ParmStr str, OStream * out);
+    // Write the output to the stdin of a spawned ARGV instead of to
+    // STR, STR is still used in line directives and is only written
+    // to if SAVE is true.  Returns the pid of the child.
+    pid_t open_pipe(ParmStr str, const char * const argv[], bool save);
+    // Write the binary form of the output (see parse.hpp) to STR.
+    void open_binary(ParmStr str);
     void close();
     void flush();
 
@@ -121,15 +131,32 @@ namespace ast {
       return *this;
     }
     CompileWriter & operator<< (int n) {
-      buf.printf("%i", n);
+      buf.append_int(n);
       return *this;
     }
     CompileWriter & operator<< (unsigned n) {
-      buf.printf("%u", n);
+      buf.append_uint(n);
+      return *this;
+    }
+    CompileWriter & operator<< (long n) {
+      buf.append_int(n);
+      return *this;
+    }
+    CompileWriter & operator<< (unsigned long n) {
+      buf.append_uint(n);
+      return *this;
+    }
+    CompileWriter & operator<< (long long n) {
+      buf.append_int(n);
+      return *this;
+    }
+    CompileWriter & operator<< (unsigned long long n) {
+      buf.append_uint(n);
       return *this;
     }
   private:
     bool set_line_info(const SourceStr & str);
+    void set_file_name(ParmStr str);
   };
 
   static inline void copy_val(void * lhs, const void * rhs, const Type * t) {
@@ -137,6 +164,7 @@ namespace ast {
   }
 
   struct AST {
+    GC_ALLOC_CATEGORY(ALLOC_AST)
     //typedef ::TypeInfo<AST> TypeInfo;
     //virtual void set_syntax_data(Syntax::Data & d) {
     //  d.type_id = TypeInfo::id;
@@ -642,6 +670,9 @@ namespace ast {
     }
   };
 
+  // True if the fun syntax P is a definition, (fun NAME PARMS RET BODY)
+  static inline bool fun_syn_has_body(const Syntax * p) {return p->num_args() > 3;}
+
   struct Fun : public TopLevelVarDecl {
     Fun() : env_ss(), is_macro(), overload(true) {}
     const char * what() const {return "fun";}
@@ -651,6 +682,8 @@ namespace ast {
     mutable bool is_macro;
     Tuple * parms;
     bool overload;
+    String cache_key;           // defined if the body may be cached
+    mutable String cached_body;
     Overloadable overloadable() const {return overload ? parms : NULL;}
     const Type * ret_type;
     Block * body;
@@ -659,6 +692,8 @@ namespace ast {
     bool static_constructor;
     //LabelSymbolTable * labels;
     Stmt * finish_parse(Environ &);
+    // A definition whose body is still waiting in the second pass
+    bool body_pending() const {return !body && syn && fun_syn_has_body(syn);}
     void compile_prep(CompileEnviron &);
     void compile(CompileWriter & f, Phase) const;
     void finalize(FinalizeEnviron &);
@@ -703,6 +738,7 @@ namespace ast {
   };
 
   struct TypeAlias : public TypeDeclaration, public SimpleType {
+    GC_ALLOC_CATEGORY(ALLOC_TYPE)
     TypeAlias(const Type * st) : SimpleType(st), of(st) {}
     const Type * of;
     const char * what() const {return "talias";}
@@ -715,6 +751,7 @@ namespace ast {
   };
 
   struct ForwardTypeDecl : public TypeDeclaration, public SimpleType {
+    GC_ALLOC_CATEGORY(ALLOC_TYPE)
     ForwardTypeDecl(const char * w) : of(), what_(w) {}
     const Type * of;
     const char * what_;
@@ -733,6 +770,7 @@ namespace ast {
   };
 
   struct StructUnion : public TypeDeclaration, public SimpleType {
+    GC_ALLOC_CATEGORY(ALLOC_TYPE)
     enum Which {STRUCT, UNION} which;
     Vector<Member> members;
     StructUnion(Which w) 
@@ -765,6 +803,7 @@ namespace ast {
   };
 
   struct Enum : public TypeDeclaration, public Int {
+    GC_ALLOC_CATEGORY(ALLOC_TYPE)
     Enum() 
       : Int(INT_MIN, INT_MAX, Int::UNDEFINED, sizeof(int)), defined(false) {}
     const char * what() const {return "enum";}
@@ -814,6 +853,7 @@ namespace ast {
 
   class UserType : public TypeDeclaration, public SimpleType {
   public:
+    GC_ALLOC_CATEGORY(ALLOC_TYPE)
     UserType() : SimpleType(USER_C), parent(), type(), module(), lt_sizeof_(NULL),
                  abi_info(&DEFAULT_ABI_INFO), defined() {}
     const Type * parent;
@@ -847,6 +887,9 @@ namespace ast {
 
   AST * parse_top(const Syntax * p, PEG * peg);
   AST * parse_top(const Syntax * p, Environ & env);
+  void enable_body_cache(ParmStr dir, ParmStr opts);
+  void cache_note_input(ParmStr file);
+
   void parse_stmts_raw(SourceStr, Environ & env);
   void parse_stmts(const Syntax * p, Environ & env);
   void parse_stmts(SourceStr str, Environ & env);
@@ -556,57 +556,57 @@ namespace ast {
 
   template <>
   void CT_Value<CT_Ptr>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%u", val.val);
+    o << (unsigned)val.val;
   }
 
   template <>
   void CT_Value<signed char>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%d", val);
+    o << val;
   }
 
   template <>
   void CT_Value<unsigned char>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%uu", val);
+    o << val << 'u';
   }
 
   template <>
   void CT_Value<short>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%d", val);
+    o << val;
   }
 
   template <>
   void CT_Value<unsigned short>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%uu", val);
+    o << val << 'u';
   }
 
   template <>
   void CT_Value<int>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%d", val);
+    o << val;
   }
 
   template <>
   void CT_Value<unsigned>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%uu", val);
+    o << val << 'u';
   }
 
   template <>
   void CT_Value<long>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%ldl", val);
+    o << val << 'l';
   }
 
   template <>
   void CT_Value<unsigned long>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%luul", val);
+    o << val << "ul";
   }
 
   template <>
   void CT_Value<long long>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%lldll", val);
+    o << val << "ll";
   }
 
   template <>
   void CT_Value<unsigned long long>::compile_c(CompileWriter & o, Exp *) const {
-    o.printf("%lluull", val);
+    o << val << "ull";
   }
 
   template <>
@@ -637,65 +637,65 @@ namespace ast {
 
   template <>
   void CT_Value<CT_Ptr>::compile(CompileWriter & o, Exp *) const {
-    o.printf("%u", val.val);
+    o << (unsigned)val.val;
   }
 
   template <>
   void CT_Value<signed char>::compile(CompileWriter & o, Exp *) const {
     //o.printf("(literal %d (signed-char)", val);
-    o.printf("%d", val);
+    o << val;
   }
 
   template <>
   void CT_Value<unsigned char>::compile(CompileWriter & o, Exp *) const {
     //o.printf("(literal %u (unsigned-char))", val);
-    o.printf("%u", val);
+    o << val;
   }
 
   template <>
   void CT_Value<short>::compile(CompileWriter & o, Exp *) const {
     //o.printf("(literal %d (short))", val);
-    o.printf("%d", val);
+    o << val;
   }
 
   template <>
   void CT_Value<unsigned short>::compile(CompileWriter & o, Exp *) const {
     //o.printf("(literal %u (unsigned-short))", val);
-    o.printf("%u", val);
+    o << val;
   }
 
   template <>
   void CT_Value<int>::compile(CompileWriter & o, Exp *) const {
     //o.printf("(literal %d (int))", val);
-    o.printf("%d", val);
+    o << val;
   }
 
   template <>
   void CT_Value<unsigned>::compile(CompileWriter & o, Exp *) const {
     if (val <= INT_MAX)
-      o.printf("%u", val);
+      o << val;
     else
-      o.printf("(n %u (unsigned))", val);
+      o << "(n " << val << " (unsigned))";
   }
 
   template <>
   void CT_Value<long>::compile(CompileWriter & o, Exp *) const {
-    o.printf("(n %ld (long))", val);
+    o << "(n " << val << " (long))";
   }
 
   template <>
   void CT_Value<unsigned long>::compile(CompileWriter & o, Exp *) const {
-    o.printf("(n %lu (unsigned-long))", val);
+    o << "(n " << val << " (unsigned-long))";
   }
 
   template <>
   void CT_Value<long long>::compile(CompileWriter & o, Exp *) const {
-    o.printf("(n %lld (long-long))", val);
+    o << "(n " << val << " (long-long))";
   }
 
   template <>
   void CT_Value<unsigned long long>::compile(CompileWriter & o, Exp *) const {
-    o.printf("(n %llu (unsigned-long-long))", val);
+    o << "(n " << val << " (unsigned-long-long))";
   }
 
   template <>
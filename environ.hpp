@@ -148,7 +148,7 @@ namespace ast {
           top_level_symbols = new TopLevelSymbolTable(&symbols.front);
           add_ast_primitives(*this); // FIXME HACK
           type_relation = new_c_type_relation(); // FIXME HACK
-          create_c_types(types); // FIXME Another HACK
+          create_c_types(types, type_relation); // FIXME Another HACK
           add_inner_nss(*this);
         }
         frame = new Frame();
@@ -2,7 +2,14 @@
 #include <algorithm>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <errno.h>
 #include <dlfcn.h>
+#include <spawn.h>
+#include <unistd.h>
+#include <sys/wait.h>
 
 #include "iostream.hpp"
 #include "peg.hpp"
@@ -12,6 +19,7 @@
 #include "parse_decl.hpp"
 #include "syntax_gather.hpp"
 #include "asc_ctype.hpp"
+#include "profile.hpp"
 
 #include "hash-t.hpp"
 
@@ -164,7 +172,7 @@ struct MapSource_ExpansionOf {
     return item.value;
   }
   MapSourceRes operator() (const Syntax * syn) {
-    return MapSourceRes(f(syn->str_.source));
+    return MapSourceRes(f(syn->src_));
   }
   MapSourceRes operator() (const ReparseSyntax * syn, const Replacements * repl);
 };
@@ -328,7 +336,7 @@ MapSourceRes MapSource_QuotedSyntax::operator()
   (const ReparseSyntax * other, const Replacements * repl) 
 {
   ReplTable * rt = new ReplTable(this);
-  return MapSourceRes(f(other->str_.source), 
+  return MapSourceRes(f(other->src_), 
                       combine_repl(repl, new ReplTable(this)));
 }
 
@@ -337,7 +345,7 @@ MapSourceRes MapSource_ExpansionOf::operator()
 {
   if (!repl || repl->empty() || repl->back()->ci != this)
     repl = combine_repl(repl, new ReplTable(this));
-  return MapSourceRes(f(syn->str_.source), repl);
+  return MapSourceRes(f(syn->src_), repl);
 }
 
 //
@@ -349,6 +357,8 @@ using namespace ast;
 void assert_pos(const Syntax * p, Position have, unsigned need);
 
 void compile_for_ct(Deps & deps, Environ & env);
+static void queue_for_ct(const Fun * fun);
+static void flush_for_ct(const Fun * need, Environ & env);
 
 // see prelude.zlh
 
@@ -374,10 +384,11 @@ namespace macro_abi {
 
 Match * match(Match * orig_m, const Syntax * pattern, const Syntax * with, unsigned shift, Mark * mark);
 
+__thread UniqCounters uniq_counters;
+
 String gen_sym() {
-  static unsigned uniq_num = 0;
   StringBuf buf;
-  buf.printf("_m_%d_", uniq_num++);
+  buf.printf("_m_%d_", uniq_counters.gen_sym++);
   return buf.freeze();
 }
 
@@ -408,10 +419,10 @@ const Syntax * replace(const Syntax * p, ReplTable::Table * match,
 static const Syntax * reparse_replace(const Syntax * new_name, 
                                       const Syntax * p, ReplTable * r);
 
-PEG * DEFAULT_PEG = NULL; // Yeah, a bit of a hack...
+static __thread PEG * DEFAULT_PEG = NULL; // Yeah, a bit of a hack...
 
 struct Macro : public MacroInfo, public Declaration, public Symbol {
-  static MapSource_ExpansionOf * macro_ci;
+  static __thread MapSource_ExpansionOf * macro_ci;
   Overloadable overloadable_;
   Macro() {}
   Overloadable overloadable() const {return overloadable_;}
@@ -428,12 +439,13 @@ struct Macro : public MacroInfo, public Declaration, public Symbol {
   virtual const Syntax * expand_p2(const Syntax * s, const Syntax * p, Environ & env) const = 0;
   const Syntax * expand(const Syntax * s, const Syntax * p, Environ & env) const {
     DEFAULT_PEG = env.peg;
-    static unsigned c0 = 0;
-    unsigned c = ++c0;
-    //printf("%d EXPAND: %s %s %s\n", c, ~s->what().to_string(), ~s->sample_w_loc(), ~p->sample_w_loc());
+    MacroProfileGuard prof(this, ~real_name.name, what());
+    TimePhase phase("expand");
+    TraceScope trace("expand", ~real_name.name, s);
     try {
       MacroInfo whocares(this, s);
       Syntax * res = expand_p2(s, p, env);
+      prof.done(res);
       return res;
     } catch (Error * err) {
       StringBuf buf = err->extra;
@@ -447,7 +459,7 @@ struct Macro : public MacroInfo, public Declaration, public Symbol {
   const Syntax * get_prop(SymbolName n) const {return props.get_prop(n);}
 };
 
-MapSource_ExpansionOf * Macro::macro_ci = NULL;
+__thread MapSource_ExpansionOf * Macro::macro_ci = NULL;
 
 extern "C"
 const Syntax * zli_handle_macro_export(const Syntax * exprt, Mark * mark,
@@ -463,7 +475,7 @@ const Syntax * zli_handle_macro_export(const Syntax * exprt, Mark * mark,
     Syntax * sym = *i;
     sym = new_syntax(SymbolName(sym->what().name, 
                                 add_mark(sym->what().marks, mark)), 
-                     (*i)->str_);
+                     (*i)->raw_str());
     if (sym->what().name == "top-level") {
       mark->export_tl = true;
       mark->export_to = normalize(export_to);
@@ -477,6 +489,145 @@ const Syntax * zli_handle_macro_export(const Syntax * exprt, Mark * mark,
   //printf(">>%s\n", ~macro_export->to_string());
 }
 
+//
+// Support for memoizing the expansion of pure macros
+//
+
+// A macro marked with the :pure flag promises that its expansion
+// depends only on its arguments.  Since a simple macro's replacement
+// does not look at the environment of the call the expansion can be
+// reused for a later call with structurally identical arguments, only
+// the mark added to the symbols introduced by the macro needs to be
+// replaced with a fresh one.  The source info of the expansion is
+// that of the first call.
+
+// Note: Reparse nodes are compared as raw text as destructuring them
+// would force them to be parsed.  The same text may parse differently
+// once the grammar is changed (new_syntax) so the PEG is compared as
+// well; extend_peg always returns a new one.
+static unsigned long pure_hash(const Syntax * p) {
+  unsigned long h = 0;
+  if (p->have_entity()) {
+    return (unsigned long)p->as_syn_entity()->d.data;
+  } else if (p->is_reparse()) {
+    const ReparseSyntax * r = p->as_reparse();
+    for (const char * i = r->outer_.begin; i != r->outer_.end; ++i)
+      h = 5*h + *i;
+    return h + (unsigned long)r->repl + (unsigned long)r->parse_info.peg;
+  } else if (p->simple()) {
+    const SymbolName & n = p->what();
+    return hash<String>()(n.name) + (unsigned long)n.marks;
+  }
+  h = p->num_parts() * 31 + p->num_flags();
+  for (parts_iterator i = p->parts_begin(), e = p->parts_end(); i != e; ++i)
+    h = 5*h + pure_hash(*i);
+  for (flags_iterator i = p->flags_begin(), e = p->flags_end(); i != e; ++i)
+    h = 5*h + pure_hash(*i);
+  return h;
+}
+
+static bool pure_equal(const Syntax * x, const Syntax * y) {
+  if (x == y) return true;
+  if (x->type_inf != y->type_inf) return false;
+  if (x->have_entity()) {
+    return x->as_syn_entity()->d.data == y->as_syn_entity()->d.data;
+  } else if (x->is_reparse()) {
+    const ReparseSyntax * a = x->as_reparse(), * b = y->as_reparse();
+    return a->repl == b->repl && a->parse_as == b->parse_as
+      && a->parse_info.peg == b->parse_info.peg
+      && a->outer_.size() == b->outer_.size()
+      && memcmp(a->outer_.begin, b->outer_.begin, a->outer_.size()) == 0
+      && pure_equal(a->what_, b->what_);
+  } else if (x->simple()) {
+    const SymbolName & a = x->what(), & b = y->what();
+    return a.name == b.name && a.marks == b.marks;
+  }
+  if (x->num_parts() != y->num_parts() || x->num_flags() != y->num_flags())
+    return false;
+  for (parts_iterator i = x->parts_begin(), j = y->parts_begin(), e = x->parts_end(); 
+       i != e; ++i, ++j)
+    if (!pure_equal(*i, *j)) return false;
+  for (flags_iterator i = x->flags_begin(), j = y->flags_begin(), e = x->flags_end(); 
+       i != e; ++i, ++j)
+    if (!pure_equal(*i, *j)) return false;
+  return true;
+}
+
+// Replaces the mark FROM with TO everywhere in a syntax object.
+// Nodes not affected are shared.  Reparse nodes are copied without
+// their cached value so that they will be reparsed lazily, just as
+// the ones created by replace.
+struct Remark {
+  const Mark * from;
+  const Mark * to;
+  Vector<std::pair<const ReplTable *, ReplTable *> > tables;
+  Remark(const Mark * f, const Mark * t) : from(f), to(t) {}
+  const Marks * operator() (const Marks * ms) {
+    if (!have_mark(from, ms)) return ms;
+    if (ms->back() == from) return add_mark(ms->pop(), to);
+    return add_mark((*this)(ms->pop()), ms->back());
+  }
+  ReplTable * operator() (ReplTable * r) {
+    if (r->mark != from) return r;
+    for (unsigned i = 0, sz = tables.size(); i != sz; ++i)
+      if (tables[i].first == r) return tables[i].second;
+    ReplTable * res = new ReplTable(*r);
+    res->mark = to;
+    tables.push_back(std::pair<const ReplTable *, ReplTable *>(r, res));
+    return res;
+  }
+  const Replacements * operator() (const Replacements * rs) {
+    if (!rs) return rs;
+    Replacements * res = NULL;
+    for (unsigned i = 0, sz = rs->size(); i != sz; ++i) {
+      ReplTable * r = (*this)((*rs)[i]);
+      if (r == (*rs)[i]) continue;
+      if (!res) res = new Replacements(*rs);
+      (*res)[i] = r;
+    }
+    return res ? res : rs;
+  }
+  const Syntax * operator() (const Syntax * p) {
+    if (p->have_entity()) {
+      return p;
+    } else if (p->is_reparse()) {
+      const ReparseSyntax * r = p->as_reparse();
+      const Syntax * what = (*this)(r->what_);
+      const Replacements * repl = (*this)(r->repl);
+      if (what == r->what_ && repl == r->repl) return p;
+      SourceStr str = r->raw_str();
+      return new ReparseSyntax(what, repl, r->parse_info, r->parse_as, r->origin,
+                               r->outer_, r->inner_, &str);
+    } else if (p->simple()) {
+      const SymbolName & n = p->what();
+      const Marks * marks = (*this)(n.marks);
+      if (marks == n.marks) return p;
+      return new_syntax(SymbolName(n.name, marks), p->raw_str());
+    }
+    SyntaxBuilder res;
+    bool changed = false;
+    for (parts_iterator i = p->parts_begin(), e = p->parts_end(); i != e; ++i) {
+      const Syntax * q = (*this)(*i);
+      if (q != *i) changed = true;
+      res.add_part(q);
+    }
+    for (flags_iterator i = p->flags_begin(), e = p->flags_end(); i != e; ++i) {
+      const Syntax * q = (*this)(*i);
+      if (q != *i) changed = true;
+      res.add_flag(q);
+    }
+    if (!changed) return p;
+    return res.build(p->str());
+  }
+};
+
+struct PureExpansion : public gc {
+  const Syntax * args;
+  const Mark * mark;
+  const Syntax * res;
+  PureExpansion * next;
+};
+
 struct SimpleMacro : public Macro {
   const char * what() const {return "simple-macro";}
   //const SourceFile * entity;
@@ -484,6 +635,8 @@ struct SimpleMacro : public Macro {
   const Syntax * exprt;
   const Syntax * repl;
   const SymbolNode * env;
+  bool pure;
+  mutable hash_map<unsigned long, PureExpansion *> pure_cache;
   SimpleMacro * parse_self(const Syntax * p, Environ & e) {
     env = e.symbols.front;
     //entity = p->str().source;
@@ -494,18 +647,19 @@ struct SimpleMacro : public Macro {
     parms = flatten(p->arg(1));
     //printf("PARSING MAP %s\n%s\n", ~real_name.to_string(), ~p->to_string());
     //printf("MAP PARMS %s: %s\n", ~p->arg(0)->what().name, ~parms->to_string());
-    exprt = p->flag("export");
+    exprt = p->flag(FLAG_EXPORT);
     if (exprt)
       exprt = exprt->arg(0);
-    const Syntax * typed_parms_syn = p->flag("typed-parms");
+    const Syntax * typed_parms_syn = p->flag(FLAG_TYPED_PARMS);
     if (typed_parms_syn) {
       //printf("TYPED PARMS = %s\n", ~typed_parms_syn->to_string());
       overloadable_ = expand_fun_parms(typed_parms_syn->arg(0), e); 
     }
-    const Syntax * id_macro = p->flag("id");
+    const Syntax * id_macro = p->flag(FLAG_ID);
     if (id_macro) {
       overloadable_ = Overloadable::AS_ID;
     }
+    pure = p->flag(FLAG_PURE);
     repl = p->arg(2)->map_source(*new MapSource_QuotedSyntax(p->arg(2)->str()));
     return this;
   }
@@ -517,12 +671,47 @@ struct SimpleMacro : public Macro {
     using macro_abi::Syntax;
     const Syntax * macro_export = NULL;
     Mark * mark = new Mark(env);
+    const Syntax * res = NULL;
+    PureExpansion * * cached = NULL;
+    if (pure) {
+      unsigned long h = 0;
+      for (parts_iterator i = p->args_begin(), e = p->args_end(); i != e; ++i)
+        h = 5*h + pure_hash(*i);
+      for (flags_iterator i = p->flags_begin(), e = p->flags_end(); i != e; ++i)
+        h = 5*h + pure_hash(*i);
+      cached = &pure_cache[h];
+      for (PureExpansion * c = *cached; c; c = c->next) {
+        if (c->args->num_parts() != p->num_parts() || c->args->num_flags() != p->num_flags())
+          continue;
+        bool same = true;
+        for (parts_iterator i = p->args_begin(), j = c->args->args_begin(), e = p->args_end(); 
+             same && i != e; ++i, ++j)
+          same = pure_equal(*i, *j);
+        for (flags_iterator i = p->flags_begin(), j = c->args->flags_begin(), e = p->flags_end(); 
+             same && i != e; ++i, ++j)
+          same = pure_equal(*i, *j);
+        if (same) {
+          res = Remark(c->mark, mark)(c->res);
+          break;
+        }
+      }
+    }
     if (exprt) 
       macro_export = zli_handle_macro_export(exprt, mark, s, p);
-    Match * m = match(NULL, parms, p, 1, mark);
-    if (!m)
-      throw error(p, "Wrong number of arguments or other mismatch in call to %s.", ~real_name.name);
-    Syntax * res = replace(repl, m, mark);
+    if (!res) {
+      Match * m = match(NULL, parms, p, 1, mark);
+      if (!m)
+        throw error(p, "Wrong number of arguments or other mismatch in call to %s.", ~real_name.name);
+      res = replace(repl, m, mark);
+      if (cached) {
+        PureExpansion * c = new PureExpansion;
+        c->args = p;
+        c->mark = mark;
+        c->res = res;
+        c->next = *cached;
+        *cached = c;
+      }
+    }
     //printf("EXPANDING MAP %s RES: %s\n", ~name, ~res->to_string());
     //printf("  %s\n", ~res->sample_w_loc());
     //res->str().source->dump_info(COUT, "    ");
@@ -552,6 +741,7 @@ struct ProcMacro : public Macro {
   const char * what() const {return "proc-macro";}
   enum FunArgs {Parms, CallParms, ParmsEnv, CallParmsEnv} fun_args;
   const Fun * fun;
+  static const TopLevelSymbolTable * types_for;
   static const Type * syntax_type;
   static const Type * environ_type;
   static const Type * environ_type_nc;
@@ -569,15 +759,17 @@ struct ProcMacro : public Macro {
     fun = lookup_overloaded_symbol<Fun>
       (NULL, p->num_args() == 1 ? p->arg(0) : p->arg(1), &e);
     fun->is_macro = true;
-    if (!syntax_type)
+    if (types_for != e.top_level_symbols) {
+      // the types belong to the top level environment, there may be
+      // more than one (see libzl.cpp)
+      types_for = e.top_level_symbols;
       syntax_type = e.types.inst(".ptr", e.types.inst("Syntax"))->root;
-    if (!environ_type)
       environ_type = e.types.inst(".ptr", 
                                   e.types.inst(".qualified",
                                                TypeParm(e.types.inst("Environ")),
                                                TypeParm(QualifiedType::CONST)))->root;
-    if (!environ_type_nc)
       environ_type_nc = e.types.inst(".ptr", e.types.inst("Environ"))->root;
+    }
     if (fun->parms->num_parms() == 0)
       throw error(p, "Invalid function prototype for macro transformer: "
                   "expected at least one argument");
@@ -614,13 +806,12 @@ struct ProcMacro : public Macro {
         fun_args = CallParms;
     }
     def = fun->syn;
+    queue_for_ct(fun);
     return this;
   }
   const Syntax * expand_p2(const Syntax * s, const Syntax * p, Environ & env) const {
     if (!fun->ct_ptr) {
-      Deps deps;
-      deps.push_back(fun);
-      compile_for_ct(deps, env);
+      flush_for_ct(fun, env);
       assert(fun->ct_ptr);
     }
     switch (fun_args) {
@@ -639,6 +830,7 @@ struct ProcMacro : public Macro {
   }
 };
 
+const TopLevelSymbolTable * ProcMacro::types_for = NULL;
 const Type * ProcMacro::syntax_type = NULL;
 const Type * ProcMacro::environ_type = NULL;
 const Type * ProcMacro::environ_type_nc = NULL;
@@ -861,7 +1053,7 @@ bool match_list(Match * m,
         n.add_parts(r_i, r_end);
         r_i = r_end;
         for (flags_iterator i = with->flags_begin(), e = with->flags_end(); i != e; ++i) {
-          if (!pattern->flag((*i)->what()))
+          if (!pattern->flag((*i)->what_id()))
             n.add_flag(*i);
         }
         r = n.build();
@@ -878,7 +1070,7 @@ bool match_list(Match * m,
   if (r_i < r_end)
     return false;
   for (flags_iterator i = pattern->flags_begin(), e = pattern->flags_end(); i != e; ++i) {
-    const Syntax * w = with->flag((*i)->what());
+    const Syntax * w = with->flag((*i)->what_id());
     match_parm(m, (*i)->arg(0), w ? w->arg(0) : NULL, rt);
   }
   return true;
@@ -1230,7 +1422,7 @@ static const Syntax * reparse_replace(const Syntax * new_name,
                                       const Syntax * p, ReplTable * r)
 {
   const ReparseSyntax * rs = p->as_reparse();
-  SourceStr str = r->expand_source_info_str(rs->str_);
+  SourceStr str = r->expand_source_info_str(rs->raw_str());
   return new ReparseSyntax(SYN(new_name, r->mark, r->expand_source_info(p->what_part())),
                            combine_repl(rs->repl, r),
                            rs->parse_info, 
@@ -1546,6 +1738,7 @@ static const Syntax * try_syntax_macro_or_primitive(const SymbolName & what,
 
 const Syntax * partly_expand(const Syntax * p, Position pos, Environ & env, unsigned flags) {
   if (p->have_entity()) return p;
+  TraceScope trace("partly_expand", trace_enabled ? ~p->what(SPECIAL_OK).name : NULL, p);
   //printf("\n>expand>%s//\n", ~p->part(0)->to_string());
   //printf("\n>expand>%s//\n", ~what);
   //p->str().sample_w_loc(COUT);
@@ -1571,7 +1764,7 @@ const Syntax * partly_expand(const Syntax * p, Position pos, Environ & env, unsi
         ? reparse_prod("EXP_", r, &env)
         : reparse_prod("STMTE", r, &env);
       if (r.str.empty()) {
-        const_cast<Syntax *>(p0)->str_ = p->str();
+        p0 = with_str(p0, p->str());
         return partly_expand(p0, pos, env, flags);
       } else {
         p0 = partly_expand(p0, pos, env, flags);
@@ -1877,7 +2070,7 @@ Stmt * parse_macro(const Syntax * p, Environ & env) {
   ProcMacro * m = new ProcMacro;
   m->parse_self(p, env);
   env.add(m->real_name, m);
-  if (p->flag("w_snapshot")) {
+  if (p->flag(FLAG_W_SNAPSHOT)) {
     m->fun->env_ss = *env.top_level_environ;
   }
   return empty_stmt();
@@ -2030,10 +2223,92 @@ const Syntax * expand_id(const Syntax * p, Environ & env) {
   }
 }
 
-void compile_for_ct(Deps & deps, Environ & env) {
+// A zls child process compiling a batch of compile-time functions.
+// The result is not loaded until something in the batch is needed.
+struct CtJob : public gc {
+  pid_t pid;
+  String source;
+  String lib;
+  Deps deps;
+};
+
+static Vector<CtJob *> ct_jobs;
+
+bool pipe_to_zls = false;
+bool save_temps = false;
+
+StringBuf * info_log = NULL;
+
+static void log_info(const char * fmt, ...) {
+  va_list ap;
+  va_start(ap, fmt);
+  if (info_log)
+    info_log->vprintf(fmt, ap);
+  else
+    vprintf(fmt, ap);
+  va_end(ap);
+}
+
+// The zlfct files of a compile go in a new temporary directory, so
+// that dlopen never sees the same path twice in one process, and are
+// removed once loaded.  With -save-temps they are kept in the current
+// directory instead.
+static String ct_dir;
+static unsigned ct_cntr = 0;
+
+static void reap_ct_jobs();
+
+static String ct_file_dir() {
+  if (ct_dir.defined()) return ct_dir;
+  static bool reap_registered = false;
+  if (!reap_registered) {
+    atexit(reap_ct_jobs);
+    reap_registered = true;
+  }
+  if (save_temps) return ct_dir = ".";
+  const char * tmp = getenv("TMPDIR");
+  StringBuf buf;
+  buf.printf("%s/zlfct.XXXXXX", tmp && *tmp ? tmp : "/tmp");
+  buf.ensure_null_end();
+  if (!mkdtemp(buf.data()))
+    throw error(NO_LOC, "Unable to create a directory for compile time code: %s",
+                strerror(errno));
+  return ct_dir = buf.freeze();
+}
+
+static void remove_ct_files(const CtJob * job) {
+  if (save_temps) return;
+  unlink(job->source);
+  unlink(job->lib);
+}
+
+// The maximum number of zls children to run at once, ZL_CT_JOBS if
+// set, otherwise the number of online processors.
+static unsigned max_ct_jobs() {
+  const char * s = getenv("ZL_CT_JOBS");
+  long n = s ? strtol(s, NULL, 10) : sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? n : 1;
+}
+
+// Don't leave zls children or their files behind for batches that
+// were never needed.
+static void reap_ct_jobs() {
+  for (Vector<CtJob *>::iterator i = ct_jobs.begin(), e = ct_jobs.end(); i != e; ++i) {
+    int status;
+    while (waitpid((*i)->pid, &status, 0) == -1 && errno == EINTR);
+    remove_ct_files(*i);
+  }
+  ct_jobs.clear();
+  if (ct_dir.defined() && !save_temps)
+    rmdir(ct_dir);
+  ct_dir = String();
+  ct_cntr = 0;
+}
+
+static CtJob * start_compile_for_ct(Deps & deps, Environ & env) {
+  TimePhase phase("compile_for_ct");
+  TraceScope trace("compile_for_ct", "start zls");
 
-  static unsigned cntr = 0;
-  
   for (unsigned i = 0, sz = deps.size(); i != sz; ++i) {
     deps.merge(deps[i]->deps());
   }
@@ -2046,31 +2321,69 @@ void compile_for_ct(Deps & deps, Environ & env) {
   //  printf("  %s\n", ~(*i)->name);
   //printf("---\n");
   
-  printf("COMPILE FOR CT: zlfct%03d\n", cntr);
+  String dir = ct_file_dir();
+  log_info("COMPILE FOR CT: zlfct%03d\n", ct_cntr);
   StringBuf buf;
-  buf.printf("./zlfct%03d.zls", cntr);
+  buf.printf("%s/zlfct%03d.zls", ~dir, ct_cntr);
   String source = buf.freeze();
-  buf.printf("./zlfct%03d.so", cntr);
+  buf.printf("%s/zlfct%03d.so", ~dir, ct_cntr);
   String lib = buf.freeze();
-  buf.printf("zls -g -fexceptions -shared -fpic -o zlfct%03d.so zlfct%03d.zls", cntr, cntr);
-  String cmd = buf.freeze();
-  cntr++;
+  ct_cntr++;
   
+  pid_t pid;
   CompileWriter cw;
-  cw.open(source, "w");
+  if (pipe_to_zls) {
+    const char * argv[] = {"zls", "-g", "-fexceptions", "-shared", "-fpic", 
+                           "-o", ~lib, "-x", "zls", "-", NULL};
+    pid = cw.open_pipe(source, argv, save_temps);
+  } else {
+    cw.open(source, "w");
+  }
   cw.deps = &deps;
   compile(env.top_level_symbols, cw);
   cw.close();
-  
-  system(cmd);
- 
-  void * lh = dlopen(lib, RTLD_NOW | RTLD_GLOBAL);
-  if (!lh) {
-    fprintf(stderr, "ERROR: %s\n", dlerror());
-    abort();
+
+  if (!pipe_to_zls) {
+    const char * argv[] = {"zls", "-g", "-fexceptions", "-shared", "-fpic", 
+                           "-o", ~lib, ~source, NULL};
+    int res = posix_spawnp(&pid, "zls", NULL, NULL, (char * const *)argv, environ);
+    if (res != 0) {
+      if (!save_temps) unlink(source);
+      throw error(NO_LOC, "Unable to run zls: %s", strerror(res));
+    }
+  }
+
+  CtJob * job = new CtJob;
+  job->pid = pid;
+  job->source = source;
+  job->lib = lib;
+  job->deps = deps;
+  ct_jobs.push_back(job);
+  return job;
+}
+
+static void finish_compile_for_ct(CtJob * job) {
+  TimePhase phase("compile_for_ct");
+  TraceScope trace("compile_for_ct", "wait for zls");
+  int status;
+  pid_t res;
+  while ((res = waitpid(job->pid, &status, 0)) == -1 && errno == EINTR);
+  ct_jobs.erase(std::find(ct_jobs.begin(), ct_jobs.end(), job));
+  if (res == -1) {
+    remove_ct_files(job);
+    throw error(NO_LOC, "Unable to wait for zls: %s", strerror(errno));
+  }
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    remove_ct_files(job);
+    throw error(NO_LOC, "zls failed to compile %s", ~job->lib);
   }
+ 
+  void * lh = dlopen(job->lib, RTLD_NOW | RTLD_GLOBAL);
+  remove_ct_files(job);
+  if (!lh)
+    throw error(NO_LOC, "Could not load compile time code: %s", dlerror());
   
-  for (Deps::const_iterator i = deps.begin(), e = deps.end(); i != e; ++i) {
+  for (Deps::const_iterator i = job->deps.begin(), e = job->deps.end(); i != e; ++i) {
     if (!(*i)->ct_ptr) { // FIXME: I need a better test
       //printf(">>%s\n", ~(*i)->uniq_name());
       void * p = dlsym(lh, (*i)->uniq_name());
@@ -2091,6 +2404,135 @@ void compile_for_ct(Deps & deps, Environ & env) {
   }
 }
 
+void compile_for_ct(Deps & deps, Environ & env) {
+  finish_compile_for_ct(start_compile_for_ct(deps, env));
+}
+
+// Macro transformers are not compiled when they are defined, instead
+// they are queued and compiled the first time any one of them is
+// needed.  At that point everything pending that can be compiled is
+// compiled together so that only one zls invocation and one dlopen
+// is needed for a file that defines several procedural macros.
+
+static Deps pending_for_ct;
+
+void reset_compile_for_ct() {
+  pending_for_ct.clear();
+  reap_ct_jobs();
+}
+
+static void queue_for_ct(const Fun * fun) {
+  if (!fun->ct_ptr)
+    pending_for_ct.insert(fun);
+}
+
+// A function whose body has not been parsed yet (i.e. it is still
+// waiting in the second pass) can not be compiled.
+static bool body_pending(const TopLevelVarDecl * d) {
+  const Fun * f = dynamic_cast<const Fun *>(d);
+  return f && !f->ct_ptr && f->body_pending();
+}
+
+// Note: deps_ is walked directly rather than using deps() as the
+// closure should not be computed before the body is parsed.
+static bool ready_for_ct(const TopLevelVarDecl * d, Deps & seen) {
+  if (seen.have(d)) return true;
+  seen.push_back(d);
+  if (body_pending(d)) return false;
+  for (Deps::const_iterator i = d->deps_.begin(), e = d->deps_.end(); i != e; ++i)
+    if (!ready_for_ct(*i, seen)) return false;
+  return true;
+}
+
+static CtJob * ct_job_for(const TopLevelVarDecl * d) {
+  for (Vector<CtJob *>::iterator i = ct_jobs.begin(), e = ct_jobs.end(); i != e; ++i)
+    if ((*i)->deps.have(d)) return *i;
+  return NULL;
+}
+
+// True if D will be written as a definition, rather than as extern,
+// when compiled for compile time.
+static bool defined_for_ct(const TopLevelVarDecl * d) {
+  if (d->ct_ptr) return false;
+  if (const Fun * f = dynamic_cast<const Fun *>(d))
+    return f->body || f->cached_body.defined();
+  return d->storage_class != SC_EXTERN;
+}
+
+// Two batches are dependent if they would both define the same
+// function or variable.
+static bool shares_uncompiled(const Deps & x, Deps & y) {
+  for (Deps::const_iterator i = x.begin(), e = x.end(); i != e; ++i) {
+    if (defined_for_ct(*i) && y.have(*i)) return true;
+  }
+  return false;
+}
+
+// A running job that defines something in CLOSURE is joined first so
+// that the new batch only refers to it as extern, otherwise it would
+// be compiled twice and any static state would be duplicated.
+static void join_overlapping_jobs(const Deps & closure) {
+  for (Deps::const_iterator i = closure.begin(), e = closure.end(); i != e; ++i) {
+    if (!defined_for_ct(*i)) continue;
+    if (CtJob * job = ct_job_for(*i))
+      finish_compile_for_ct(job);
+  }
+}
+
+// Everything that is ready is split into independent batches which
+// are compiled concurrently, one zls process per batch.  Only the
+// batch containing the needed function is waited on; the others keep
+// compiling while parsing continues and are joined when (and if) one
+// of their functions is needed.
+static void flush_for_ct(const Fun * need, Environ & env) {
+  if (CtJob * job = ct_job_for(need)) {
+    finish_compile_for_ct(job);
+    return;
+  }
+  Vector<Deps> batches(1);
+  Vector<Deps> closures(1);
+  batches[0].push_back(need);
+  closures[0] = need->deps();
+  closures[0].insert(need);
+  Deps still_pending;
+  for (Deps::const_iterator i = pending_for_ct.begin(), e = pending_for_ct.end(); i != e; ++i) {
+    if ((*i)->ct_ptr || *i == need || ct_job_for(*i)) continue;
+    Deps seen;
+    if (!ready_for_ct(*i, seen)) {
+      still_pending.push_back(*i);
+      continue;
+    }
+    Deps closure = (*i)->deps();
+    closure.insert(*i);
+    unsigned j = 0;
+    while (j != batches.size() && !shares_uncompiled(closure, closures[j])) ++j;
+    if (j == batches.size()) {
+      batches.resize(j + 1);
+      closures.resize(j + 1);
+    }
+    batches[j].push_back(*i);
+    closures[j].merge(closure);
+  }
+  pending_for_ct = still_pending;
+  unsigned max_jobs = max_ct_jobs();
+  unsigned avail = max_jobs > ct_jobs.size() ? max_jobs - ct_jobs.size() : 1;
+  for (unsigned j = avail; j < batches.size(); ++j) {
+    batches[j % avail].merge(batches[j]);
+    closures[j % avail].merge(closures[j]);
+  }
+  if (batches.size() > avail) {
+    batches.resize(avail);
+    closures.resize(avail);
+  }
+  join_overlapping_jobs(closures[0]);
+  CtJob * needed = start_compile_for_ct(batches[0], env);
+  for (unsigned j = 1; j < batches.size(); ++j) {
+    join_overlapping_jobs(closures[j]);
+    start_compile_for_ct(batches[j], env);
+  }
+  finish_compile_for_ct(needed);
+}
+
 struct Syntaxes {
   const char * what; 
   const char * str;
@@ -2118,12 +2560,13 @@ extern "C" AbiInfo * environ_get_abi_info(const Environ * env) {
 
 
 void load_macro_lib(ParmString lib, Environ & env) {
-  printf("LOADING: %s\n", lib.str());
+  TimePhase phase("load macro lib");
+  TraceScope trace("load", "macro lib");
+  log_info("LOADING: %s\n", lib.str());
+  cache_note_input(lib);
   void * lh = dlopen(lib, RTLD_NOW | RTLD_GLOBAL);
-  if (!lh) {
-    fprintf(stderr, "ERROR: %s\n", dlerror());
-    abort();
-  }
+  if (!lh)
+    throw error(NO_LOC, "Could not load macro library: %s", dlerror());
   void * abi_list_size_0 = dlsym(lh, "_abi_list_size");
   if (abi_list_size_0) {
     unsigned abi_list_size = *(unsigned *)abi_list_size_0;
@@ -2134,16 +2577,18 @@ void load_macro_lib(ParmString lib, Environ & env) {
       AbiInfo * existing = ast::get_abi_info(i->abi_name);
       bool find_module = false;
       if (existing) {
+        // the same lib may be loaded again into a new environment
+        // (see libzl.cpp)
         if (i->mangler) {
-          assert(!existing->mangler); // FIXME: Error message
+          assert(!existing->mangler || existing->mangler == i->mangler); // FIXME: Error message
           existing->mangler = i->mangler;
         }
         if (i->parse_class) {
-          assert(!existing->parse_class); // FIXME: Error message
+          assert(!existing->parse_class || existing->parse_class == i->parse_class); // FIXME: Error message
           existing->parse_class = i->parse_class;
         }
         if (i->module_name) {
-          assert(!existing->module_name);
+          assert(!existing->module_name || strcmp(existing->module_name, i->module_name) == 0);
           existing->module_name = i->module_name;
           find_module = true;
         }
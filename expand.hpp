@@ -111,10 +111,34 @@ void assert_num_args(const Syntax * p, unsigned min, unsigned max);
 
 String gen_sym();
 
+// Counters used to generate unique names.  They are reset for each
+// compilation so that the output does not depend on what else was
+// compiled in the same process (see libzl.cpp).
+struct UniqCounters {
+  unsigned gen_sym;   // gen_sym()
+  unsigned anon_decl; // anonymous structs etc, in parse_decl.cpp
+  unsigned temp;      // temporaries, in ast.cpp
+};
+extern __thread UniqCounters uniq_counters;
+
 const Syntax * flatten(const Syntax * p);
 
 void load_macro_lib(ParmString lib, Environ & env);
 
+// Informational messages such as the macro libraries loaded go here
+// if set rather than to stdout, libzl hands them to the host.
+extern StringBuf * info_log;
+
+// Drop the procedural macros waiting to be compiled and wait for any
+// zls children still running, for when a compile is abandoned or a
+// new one starts in the same process (see libzl.cpp).
+void reset_compile_for_ct();
+
+// If set the .zls output is piped directly into zls rather than
+// written to disk first, SAVE_TEMPS keeps a copy of the file anyway.
+extern bool pipe_to_zls;
+extern bool save_temps;
+
 struct MacroInfo {
   ast::SymbolKey real_name;
   const Syntax * def;
@@ -161,7 +185,7 @@ struct MapSource_QuotedSyntax {
     return item.value;
   }
   MapSourceRes operator() (const Syntax * other) {
-    return MapSourceRes(f(other->str_.source));
+    return MapSourceRes(f(other->src_));
   }
   MapSourceRes operator() (const ReparseSyntax * other, const Replacements * repl);
 };
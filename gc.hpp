@@ -20,13 +20,88 @@ struct gc_cleanup {};
 #define gc_allocator std::allocator
 
 #define GC_disable()
-#define GC_MALLOC(size) calloc(size, 1)
-#define GC_MALLOC_UNCOLLECTABLE(size) calloc(size, 1)
-#define GC_MALLOC_ATOMIC(size) malloc(size)
+#define GC_MALLOC(size) gc_malloc(size, gc_alloc_cat)
+#define GC_MALLOC_UNCOLLECTABLE(size) gc_malloc(size, gc_alloc_cat)
+#define GC_MALLOC_ATOMIC(size) gc_malloc_atomic(size, gc_alloc_cat)
 #define GC_FREE(ptr) free(ptr)
 #define GC_REALLOC realloc
 #define GC_gcollect() 
 
 #endif // NO_GC
 
+// Allocation accounting.  Without a collector the GC_MALLOC family
+// counts the bytes and objects allocated in each category, see
+// alloc_report in profile.hpp.  Memory is counted against the
+// category of the class for classes that use GC_ALLOC_CATEGORY, or
+// the current category of the thread otherwise, which can be changed
+// with GcAllocCategory.  Everything else is ALLOC_OTHER.  With a
+// collector these are no-ops.
+
+enum GcAllocCat {ALLOC_OTHER, ALLOC_SYNTAX, ALLOC_SYMBOL_NODE, ALLOC_PACKRAT,
+                 ALLOC_STRING, ALLOC_AST, ALLOC_TYPE, ALLOC_MARK, ALLOC_NUM_CATS};
+
+#ifndef NO_GC
+
+#define GC_MALLOC_CAT(size, cat) GC_MALLOC(size)
+#define GC_MALLOC_ATOMIC_CAT(size, cat) GC_MALLOC_ATOMIC(size)
+#define GC_ALLOC_CATEGORY(cat)
+
+struct GcAllocCategory {
+  GcAllocCategory(GcAllocCat) {}
+};
+
+#else
+
+#include <stdlib.h>
+
+struct GcAllocCount {
+  unsigned long long bytes;
+  unsigned long long objects;
+};
+
+extern GcAllocCount gc_alloc_counts[ALLOC_NUM_CATS];
+extern __thread GcAllocCat gc_alloc_cat;
+
+// When sampling every gc_alloc_sample_period'th allocation of a
+// thread records its call stack
+extern unsigned gc_alloc_sample_period;
+extern __thread unsigned gc_alloc_sample_count;
+void gc_alloc_sample(size_t size, GcAllocCat cat);
+
+inline void * gc_count_alloc(void * p, size_t size, GcAllocCat cat) {
+  __atomic_fetch_add(&gc_alloc_counts[cat].bytes, size, __ATOMIC_RELAXED);
+  __atomic_fetch_add(&gc_alloc_counts[cat].objects, 1, __ATOMIC_RELAXED);
+  if (gc_alloc_sample_period && ++gc_alloc_sample_count >= gc_alloc_sample_period) {
+    gc_alloc_sample_count = 0;
+    gc_alloc_sample(size, cat);
+  }
+  return p;
+}
+
+inline void * gc_malloc(size_t size, GcAllocCat cat) {
+  return gc_count_alloc(calloc(size, 1), size, cat);
+}
+
+inline void * gc_malloc_atomic(size_t size, GcAllocCat cat) {
+  return gc_count_alloc(malloc(size), size, cat);
+}
+
+#define GC_MALLOC_CAT(size, cat) gc_malloc(size, cat)
+#define GC_MALLOC_ATOMIC_CAT(size, cat) gc_malloc_atomic(size, cat)
+
+// Goes in the body of a class, objects of it and its subclasses are
+// counted against CAT
+#define GC_ALLOC_CATEGORY(cat) \
+  static void * operator new(size_t size) {return gc_malloc(size, cat);} \
+  static void * operator new(size_t, void * p) {return p;} \
+  static void operator delete(void * p) {free(p);}
+
+struct GcAllocCategory {
+  GcAllocCat prev;
+  GcAllocCategory(GcAllocCat cat) : prev(gc_alloc_cat) {gc_alloc_cat = cat;}
+  ~GcAllocCategory() {gc_alloc_cat = prev;}
+};
+
+#endif
+
 #endif
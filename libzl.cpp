@@ -0,0 +1,174 @@
+#include <string.h>
+
+#include "config.h"
+
+#include "libzl.h"
+
+#include "parse.hpp"
+#include "ast.hpp"
+#include "parse_op.hpp"
+#include "peg.hpp"
+#include "expand.hpp"
+
+// The C interface in libzl.h.  Everything main.cpp does up to the
+// point of writing the output is done here, but the grammar and the
+// prelude sources are only loaded once per zl_env.  Declarations are
+// added to an environment in place so the prelude itself is still
+// expanded again for each compilation, in a new ast::Environ.
+//
+// The macro libraries loaded by the prelude hold pointers into the
+// environment that loaded them so compilations that use the prelude
+// must not run at the same time, even with separate zl_envs.
+
+struct zl_env : public gc {
+  unsigned flags;
+  PEG * peg;
+  SourceFile * maps;
+  SourceFile * prelude;
+  SourceFile * prelude_extra;
+  SourceFile * prelude_cpp;
+  String diag;
+};
+
+static bool ops_loaded = false;
+
+static SourceFile * internal_source_file(const char * fn) {
+  SourceFile * f = new_source_file(fn);
+  f->internal = true;
+  return f;
+}
+
+extern "C"
+zl_env * zl_env_new(unsigned flags) {
+  zl_env * z = new zl_env();
+  z->flags = flags;
+  try {
+    if (!ops_loaded) {
+      parse_exp_->init();
+      ops_loaded = true;
+    }
+    z->peg = parse_peg(SOURCE_PREFIX "grammer.in");
+    z->maps = internal_source_file(SOURCE_PREFIX "grammer.ins");
+    z->prelude = internal_source_file(SOURCE_PREFIX "prelude.zlh");
+    if (!(flags & ZL_NO_PRELUDE))
+      z->prelude_extra = new_source_file(SOURCE_PREFIX "prelude-extra.zlh");
+    if (flags & (ZL_CPP_MODE | ZL_GCC_ABI))
+      z->prelude_cpp = new_source_file(SOURCE_PREFIX "prelude-c++.zlh");
+  } catch (Error * err) {
+    z->peg = NULL;
+    z->diag = err->message();
+  }
+  return z;
+}
+
+extern "C"
+void zl_env_free(zl_env * z) {
+  delete z;
+}
+
+extern "C"
+const char * zl_diagnostics(const zl_env * z) {
+  return z->diag.defined() ? ~z->diag : NULL;
+}
+
+static void parse_maps(SourceFile * code, ast::Environ & env) {
+  SourceStr str(code);
+  parse_prod("S_SPACING", str, ParseInfo(env.peg), &env);
+  while (!str.empty()) {
+    const Syntax * p = parse_prod("SEXP", str, ParseInfo(env.peg), &env);
+    parse_prod("S_SPACING", str, ParseInfo(env.peg), &env);
+    read_macro(p, env);
+  }
+}
+
+// Passes everything written on to the caller
+struct CallbackStream : public OStream {
+  zl_output_fn fn;
+  void * data;
+  CallbackStream(zl_output_fn f, void * d) : fn(f), data(d) {}
+  void write(char c) {fn(data, &c, 1);}
+  void write(ParmStr str) {fn(data, str, str.size());}
+  void write(const void * d, unsigned int size) {fn(data, (const char *)d, size);}
+  int vprintf(const char * format, va_list ap) {
+    StringBuf buf;
+    int res = buf.vprintf(format, ap);
+    write(buf.data(), buf.size());
+    return res;
+  }
+};
+
+extern "C"
+int zl_compile(zl_env * z, const char * name, const char * src, size_t size,
+               zl_output_fn out_fn, void * data)
+{
+  if (!z->peg) return 1;
+  z->diag = String();
+  unsigned flags = z->flags;
+  StringBuf log;
+  info_log = &log;
+  try {
+    uniq_counters = UniqCounters();
+    reset_compile_for_ct();
+    ast::Environ env(ast::TOPLEVEL, z->peg);
+    parse_maps(z->maps, env);
+    ast::parse_stmts(SourceStr(z->prelude), env);
+    if (!(flags & ZL_NO_PRELUDE)) {
+      load_macro_lib(SOURCE_PREFIX "prelude-fct.so", env);
+      ast::parse_stmts(SourceStr(z->prelude_extra), env);
+    }
+    if (z->prelude_cpp)
+      ast::parse_stmts(SourceStr(z->prelude_cpp), env);
+    if (flags & ZL_C_MODE)
+      env.mangle = false;
+    SourceFile * code = new_source_file(name, src, size);
+    if (flags & ZL_GCC_ABI)
+      ast::parse_stmts_wrap_abi(SourceStr(code), "gcc", env);
+    else
+      ast::parse_stmts(SourceStr(code), env);
+    StringBuf output_fn;
+    const char * dot = strrchr(name, '.');
+    output_fn.append(name, dot ? dot : name + strlen(name));
+    output_fn.append(".zls");
+    ast::CompileWriter out;
+    out.open(output_fn.freeze(), new CallbackStream(out_fn, data));
+    ast::compile(env.top_level_symbols, out);
+    out.close();
+  } catch (Error * err) {
+    reset_compile_for_ct();
+    info_log = NULL;
+    log << err->message();
+    z->diag = log.freeze();
+    return 1;
+  }
+  info_log = NULL;
+  if (!log.empty()) z->diag = log.freeze();
+  return 0;
+}
+
+struct BufOutput {
+  char * buf;
+  size_t buf_size;
+  size_t size;
+};
+
+static void buf_output(void * data, const char * str, size_t size) {
+  BufOutput * o = (BufOutput *)data;
+  if (o->size < o->buf_size) {
+    size_t n = o->buf_size - o->size;
+    if (n > size) n = size;
+    memcpy(o->buf + o->size, str, n);
+  }
+  o->size += size;
+}
+
+extern "C"
+int zl_compile_to_buf(zl_env * z, const char * name, const char * src, size_t size,
+                      char * buf, size_t buf_size, size_t * needed)
+{
+  BufOutput o = {buf, buf_size, 0};
+  int res = zl_compile(z, name, src, size, buf_output, &o);
+  if (buf_size > 0)
+    buf[o.size < buf_size ? o.size : buf_size - 1] = '\0';
+  if (needed) *needed = o.size;
+  return res;
+}
@@ -0,0 +1,54 @@
+/* C interface to the zl compiler for use inside a long lived host
+   process, see libzl.cpp.  The host should link against libzl.so (or
+   dlopen it with RTLD_GLOBAL) as the prelude macro libraries call
+   back into it. */
+
+#ifndef LIBZL__H
+#define LIBZL__H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct zl_env zl_env;
+
+/* flags for zl_env_new, same as the zl options given */
+enum {
+  ZL_NO_PRELUDE = 1, /* -P */
+  ZL_C_MODE     = 2, /* -xc */
+  ZL_CPP_MODE   = 4, /* -xc++ */
+  ZL_GCC_ABI    = 8  /* -xg++ */
+};
+
+/* Load the grammar and the prelude sources.  If that fails
+   zl_diagnostics will return the error and any compile will fail. */
+zl_env * zl_env_new(unsigned flags);
+void zl_env_free(zl_env *);
+
+/* Called with each piece of the .zls output in order */
+typedef void (*zl_output_fn)(void * data, const char * str, size_t size);
+
+/* Compile SIZE bytes of SRC, NAME is used for line information in
+   the output and error messages.  Returns 0 on success, otherwise the
+   error is available from zl_diagnostics. */
+int zl_compile(zl_env *, const char * name, const char * src, size_t size,
+               zl_output_fn out, void * data);
+
+/* As zl_compile but the output is copied into BUF which is null
+   terminated.  NEEDED is set to the size of the full output, if it is
+   not less than BUF_SIZE the output was truncated. */
+int zl_compile_to_buf(zl_env *, const char * name, const char * src, size_t size,
+                      char * buf, size_t buf_size, size_t * needed);
+
+/* The messages from the last call, or NULL if there were none.  On
+   failure they end with the error, otherwise they are notes such as
+   the macro libraries loaded. */
+const char * zl_diagnostics(const zl_env *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -1,7 +1,9 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <errno.h>
 
 #include "config.h"
 
@@ -10,6 +12,7 @@
 #include "parse_op.hpp"
 #include "peg.hpp"
 #include "expand.hpp"
+#include "profile.hpp"
 
 extern "C" {
 //#include <gc_backptr.h>
@@ -43,9 +46,23 @@ int main(int argc, const char *argv[])
 
   assert(setvbuf(stdin, 0, _IOLBF, 0) == 0); 
   assert(setvbuf(stdout, 0, _IOLBF, 0) == 0);
-  parse_exp_->init();
+  unsigned offset = 1;
+  // "-ftime-report" is checked first so that loading the grammar is
+  // included, "-ftime-report=json" writes <base>.time-report.json
+  // instead of the table
+  bool time_report_as_json = false;
+  if (argc > offset && strcmp(argv[offset], "-ftime-report") == 0) {
+    time_report_enabled = true;
+    offset++;
+  } else if (argc > offset && strcmp(argv[offset], "-ftime-report=json") == 0) {
+    time_report_enabled = true;
+    time_report_as_json = true;
+    offset++;
+  }
   PEG * peg = NULL;
   try {
+    TimePhase phase("grammar");
+    parse_exp_->init();
     peg = parse_peg(SOURCE_PREFIX "grammer.in");
   } catch (Error * err) {
     fprintf(stderr, "%s\n", err->message().c_str());
@@ -54,9 +71,13 @@ int main(int argc, const char *argv[])
   ast::Environ env(ast::TOPLEVEL, peg);
   SourceFile * code = NULL;
   try {
-    unsigned offset = 1;
+    if (argc > offset && strcmp(argv[offset], "-macro-profile") == 0) {
+      macro_profile_enabled = true;
+      offset++;
+    }
     bool debug_mode = false;
     bool zls_mode = false;
+    bool binary = false;
     bool c_mode = false;
     bool cpp_mode = false;
     bool gcc_abi = false;
@@ -71,6 +92,10 @@ int main(int argc, const char *argv[])
       zls_mode = true;
       offset++;
     }
+    if (argc > offset && strcmp(argv[offset], "-b") == 0) {
+      binary = true;
+      offset++;
+    }
     if (argc > offset && strcmp(argv[offset], "-C") == 0) {
       for_ct = true;
       offset++;
@@ -96,6 +121,25 @@ int main(int argc, const char *argv[])
       pp_mode = true;
       offset++;
     }
+    if (argc > offset && strcmp(argv[offset], "-pipe") == 0) {
+      pipe_to_zls = true;
+      offset++;
+    }
+    if (argc > offset && strcmp(argv[offset], "-save-temps") == 0) {
+      save_temps = true;
+      offset++;
+    }
+    const char * cache_dir = getenv("ZL_CACHE_DIR");
+    if (cache_dir && *cache_dir && !zls_mode && !for_ct) {
+      // the flags affect how everything is parsed so they are part of
+      // the cache key
+      StringBuf opts;
+      for (unsigned i = 1; i < offset; ++i)
+        opts << argv[i] << ' ';
+      ast::enable_body_cache(cache_dir, opts.freeze());
+      ast::cache_note_input(SOURCE_PREFIX "grammer.in");
+      ast::cache_note_input(SOURCE_PREFIX "grammer.ins");
+    }
     String base_name;
     String output_fn;
     if (argc > offset) {
@@ -108,18 +152,18 @@ int main(int argc, const char *argv[])
         StringBuf buf;
         buf.append(argv[offset], dot);
         base_name = buf.freeze(); // will also reset buf
-        if (strcmp(dot, ".zls") == 0)
+        if (strcmp(dot, ".zls") == 0 || strcmp(dot, ".zlb") == 0)
           buf.append(argv[offset]);
         else
           buf.append(argv[offset], dot);
-        buf.append(".zls");
+        buf.append(binary ? ".zlb" : ".zls");
         output_fn = buf.freeze();
         if (strcmp(dot, ".cpp") == 0)
           cpp_mode = true;
       }
     } else {
         code = new_source_file(STDIN_FILENO);
-        output_fn = "a.out.zls";
+        output_fn = binary ? "a.out.zlb" : "a.out.zls";
     }
     //const Syntax * res = parse_str("TEST", SourceStr(code->entity(), code->begin(), code->end()));
     //res->print();
@@ -131,11 +175,18 @@ int main(int argc, const char *argv[])
       env.mangle = false;
       ast::parse_stmts_raw(SourceStr(code), env);
     } else {
-      parse_maps(env);
+      {
+        TimePhase phase("parse_maps");
+        parse_maps(env);
+      }
       SourceFile * prelude = new_source_file(SOURCE_PREFIX "prelude.zlh");
       prelude->internal = true;
-      ast::parse_stmts(SourceStr(prelude), env);
+      {
+        TimePhase phase("prelude.zlh");
+        ast::parse_stmts(SourceStr(prelude), env);
+      }
       if (debug_mode && load_prelude) {
+        TimePhase phase("prelude.zl");
         SourceFile * prelude_body = new_source_file(SOURCE_PREFIX "prelude.zl");
         ast::parse_stmts(SourceStr(prelude_body), env);
         //SourceFile * class_body = new_source_file(SOURCE_PREFIX "class.zl");
@@ -144,10 +195,12 @@ int main(int argc, const char *argv[])
         load_macro_lib(SOURCE_PREFIX "prelude-fct.so", env);
       }
       if (load_prelude && !debug_mode /* debug mode doesn't work with new abi stuff yet */ ) {
+        TimePhase phase("prelude-extra.zlh");
         SourceFile * prelude_extra = new_source_file(SOURCE_PREFIX "prelude-extra.zlh");
         ast::parse_stmts(SourceStr(prelude_extra), env);
       }
       if (cpp_mode) {
+        TimePhase phase("prelude-c++.zlh");
         SourceFile * prelude_cpp = new_source_file(SOURCE_PREFIX "prelude-c++.zlh");
         ast::parse_stmts(SourceStr(prelude_cpp), env);
       }
@@ -156,6 +209,9 @@ int main(int argc, const char *argv[])
         //ast::include_file(SOURCE_PREFIX "test/class-this_reg.zlh", env);
       if (c_mode)
         env.mangle = false;
+      // the self time of this phase is building the AST and type
+      // checking, parsing and macro expansion have their own phases
+      TimePhase phase("user code");
       if (gcc_abi) {
         ast::parse_stmts_wrap_abi(SourceStr(code), "gcc", env);
       } else {
@@ -163,34 +219,96 @@ int main(int argc, const char *argv[])
       }
     }
     ast::CompileWriter out;
-    out.open(output_fn, "w");
+    pid_t zls_pid = -1;
+    if (binary) {
+      pipe_to_zls = false;
+      out.open_binary(output_fn);
+    } else if (pipe_to_zls) {
+      // any arguments after the file name are passed on to zls
+      Vector<const char *> zls_argv;
+      zls_argv.push_back("zls");
+      String fct_lib;
+      if (for_ct) {
+        StringBuf buf;
+        buf << base_name << "-fct.so";
+        fct_lib = buf.freeze();
+        const char * ops[] = {"-O", "-g", "-fexceptions", "-shared", "-fpic", "-o", ~fct_lib};
+        zls_argv.insert(zls_argv.end(), ops, ops + sizeof(ops)/sizeof(ops[0]));
+      } else {
+        for (int i = offset + 1; i < argc; ++i)
+          zls_argv.push_back(argv[i]);
+      }
+      zls_argv.push_back("-x");
+      zls_argv.push_back("zls");
+      zls_argv.push_back("-");
+      zls_argv.push_back(NULL);
+      zls_pid = out.open_pipe(output_fn, zls_argv.data(), save_temps);
+    } else {
+      out.open(output_fn, "w");
+    }
     if (for_ct) 
       out.for_macro_sep_c = new ast::CompileWriter::ForMacroSepC;
     //printf("FORCING COLLECTION\n");
     //GC_gcollect();
     //GC_dump();
-    ast::compile(env.top_level_symbols, out);
+    {
+      TimePhase phase("emit");
+      ast::compile(env.top_level_symbols, out);
+    }
     //ast::CompileWriter out2(ast::CompileWriter::ZLE);
     //out2.open("a.out.zle", "w");
     //ast::compile(env.top_level_symbols, out2);
     //AST::ExecEnviron env;
     //ast->eval(env);
-    if (for_ct) {
-      out.close();
-      StringBuf buf;
-      buf.printf("zls -O -g -fexceptions -shared -fpic -o %s-fct.so %s", ~base_name, ~output_fn);
-      String line = buf.freeze();
-      printf("%s\n", ~line);
-      int res = system(~line);
-      if (res == -1) {
-        perror("system(\"zls ...\")");
-        exit(2);
-      } else if (res != 0) {
-        exit(1);
+    if (pipe_to_zls || for_ct) {
+      TimePhase phase("zls");
+      if (pipe_to_zls) {
+        out.close();
+        int status;
+        pid_t res;
+        while ((res = waitpid(zls_pid, &status, 0)) == -1 && errno == EINTR);
+        if (res == -1) {
+          perror("waitpid(zls)");
+          exit(2);
+        } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+          exit(1);
+        }
+      } else if (for_ct) {
+        out.close();
+        StringBuf buf;
+        buf.printf("zls -O -g -fexceptions -shared -fpic -o %s-fct.so %s", ~base_name, ~output_fn);
+        String line = buf.freeze();
+        printf("%s\n", ~line);
+        int res = system(~line);
+        if (res == -1) {
+          perror("system(\"zls ...\")");
+          exit(2);
+        } else if (res != 0) {
+          exit(1);
+        }
       }
     }
     out.for_macro_sep_c = NULL;
 
+    if (time_report_as_json) {
+      StringBuf buf;
+      buf << (base_name.defined() ? base_name : String("a.out")) << ".time-report.json";
+      FILE * f = fopen(~buf.freeze(), "w");
+      if (f) {
+        time_report_json(f);
+        fclose(f);
+      }
+    } else if (time_report_enabled) {
+      time_report(stderr);
+    }
+
+    if (macro_profile_enabled) {
+      macro_profile_report(stderr);
+      StringBuf buf;
+      buf << (base_name.defined() ? base_name : String("a.out")) << ".macro-stacks";
+      macro_profile_write_stacks(~buf.freeze());
+    }
+
     //fprintf(stderr, "---------------------------------------------\n");
     //GC_generate_random_backtrace();
     //fprintf(stderr, "---------------------------------------------\n");
@@ -14,6 +14,28 @@
 
 //namespace acommon {
 
+  // Integer formatting without going through printf.  The digits are
+  // written backwards ending at END and a pointer to the first
+  // character is returned.  There must be room for at least
+  // FORMAT_INT_MAX characters before END.
+
+  static const unsigned FORMAT_INT_MAX = 24;
+
+  static inline char * format_uint(char * end, unsigned long long n) {
+    do {
+      *--end = '0' + n % 10;
+      n /= 10;
+    } while (n);
+    return end;
+  }
+
+  static inline char * format_int(char * end, long long n) {
+    if (n >= 0) return format_uint(end, n);
+    end = format_uint(end, -(unsigned long long)n);
+    *--end = '-';
+    return end;
+  }
+
   // FIXME: Add Print Method compatible with printf and friends.
   //   Than avoid code bloat by using it in many places instead of
   //   out << "Bla " << something << " djdkdk " << something else << "\n"
@@ -61,12 +83,16 @@
     }
 
     OStream & operator<< (unsigned int num) {
-      this->printf("%u", num);
+      char buf[FORMAT_INT_MAX], * end = buf + FORMAT_INT_MAX;
+      char * b = format_uint(end, num);
+      write(b, end - b);
       return *this;
     }
 
     OStream & operator<< (int num) {
-      this->printf("%i", num);
+      char buf[FORMAT_INT_MAX], * end = buf + FORMAT_INT_MAX;
+      char * b = format_int(end, num);
+      write(b, end - b);
       return *this;
     }
 
@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "parse.hpp"
 #include "parse_common.hpp"
@@ -7,11 +8,22 @@
 #include "asc_ctype.hpp"
 #include "error.hpp"
 
+#include "hash-t.hpp"
+
 static const char * s_id(const SourceStr & str, String & res) {
+  const char * p = str.begin;
+  // common case, nothing to unescape so share the interned copy
+  while (p != str.end && !asc_isspace(*p) && *p != '(' && *p != ')' && *p != '#' 
+         && *p != '"' && *p != '\\')
+    ++p;
+  if (p == str.end || (*p != '"' && *p != '\\')) {
+    res = p == str.begin ? String() : syntax_ns::intern_str(str.begin, p);
+    return p;
+  }
   bool have_quotes = false;
   bool in_quote = false;
   StringBuf buf;
-  const char * p = str.begin;
+  buf.append(str.begin, p);
   while (p != str.end) {
     if ((asc_isspace(*p) || *p == '(' || *p == ')' || *p == '#') && !in_quote) break;
     if (*p == '"') {
@@ -56,7 +68,7 @@ namespace parse_parse {
       SyntaxLeaf * r = new SyntaxLeaf(str);
       const char * p = str.begin;
       p = s_id(str, r->what_);
-      r->str_.end = p;
+      r->set_str(SourceStr(r->raw_str(), p));
       return Res(p, r);
     }
   }
@@ -92,7 +104,7 @@ namespace parse_parse {
       } else {
         SyntaxLeaf * r = new SyntaxLeaf(str);
         str.begin = s_id(str, r->what_);
-        r->str_.end = str.begin;
+        r->set_str(SourceStr(r->raw_str(), str.begin));
         res.add_part(r);
       }
       str.begin = spacing(str);
@@ -103,6 +115,221 @@ namespace parse_parse {
     str.begin = spacing(str);
     return Res(str.begin, res.build(rstr));
   }
+
+  //
+  // The binary form starts with BINARY_MAGIC followed by a stream of
+  // one byte tags:
+  //   OPEN ... CLOSE   a list
+  //   FLAG <item>      the next item is a flag of the enclosing list
+  //   LEAF_NEW <varint len> <bytes>
+  //                    a leaf, the name is added to the symbol table
+  //   LEAF <varint idx>  a leaf whose name is in the symbol table
+  //   LEAF_NULL        a leaf with no name, ie for ": "
+  // Varints are 7 bits per byte, least significant first.  Comments
+  // and spacing are dropped so the leaves have no source positions.
+  //
+
+  static const char BINARY_MAGIC[4] = {'Z', 'L', 'B', '\1'};
+
+  enum {OPEN = 1, CLOSE, FLAG, LEAF_NEW, LEAF, LEAF_NULL};
+
+  bool is_binary(const SourceStr & str) {
+    return str.size() >= sizeof(BINARY_MAGIC) 
+      && memcmp(str.begin, BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
+  }
+
+  BinaryWriter::BinaryWriter(OStream * out) 
+    : out_(out), state_(Space), in_quote_(false), have_quotes_(false), escape_(false) 
+  {
+    out_->write(BINARY_MAGIC, sizeof(BINARY_MAGIC));
+  }
+
+  BinaryWriter::~BinaryWriter() {
+    if (state_ == Id) end_id();
+    flush();
+    delete out_;
+  }
+
+  int BinaryWriter::vprintf(const char * format, va_list ap) {
+    StringBuf buf;
+    int res = buf.vprintf(format, ap);
+    write(buf.data(), buf.size());
+    return res;
+  }
+
+  void BinaryWriter::flush() {
+    out_->write(buf_.data(), buf_.size());
+    buf_.clear();
+  }
+
+  void BinaryWriter::varint(unsigned v) {
+    while (v >= 0x80) {
+      buf_ += (char)((v & 0x7F) | 0x80);
+      v >>= 7;
+    }
+    buf_ += (char)v;
+  }
+
+  void BinaryWriter::leaf(String name) {
+    if (!name.defined()) {
+      buf_ += (char)LEAF_NULL;
+      return;
+    }
+    hash_map<String, unsigned>::iterator i = syms_.find(name);
+    if (i != syms_.end()) {
+      buf_ += (char)LEAF;
+      varint(i->second);
+    } else {
+      unsigned idx = syms_.size();
+      syms_.insert(name, idx);
+      buf_ += (char)LEAF_NEW;
+      varint(name.size());
+      buf_.append(name.begin(), name.size());
+    }
+  }
+
+  // The same rules as s_id
+  void BinaryWriter::start_id() {
+    state_ = Id;
+    tok_.clear();
+    in_quote_ = have_quotes_ = escape_ = false;
+  }
+
+  void BinaryWriter::id_char(char c) {
+    if (escape_) {
+      escape_ = false;
+    } else if (c == '"') {
+      have_quotes_ = true;
+      in_quote_ = !in_quote_;
+      return;
+    } else if (c == '\\') {
+      escape_ = true;
+    }
+    tok_ += c;
+  }
+
+  void BinaryWriter::end_id() {
+    String name = tok_.freeze();
+    if (name.empty() && !have_quotes_)
+      name = String();
+    leaf(name);
+    state_ = Space;
+  }
+
+  void BinaryWriter::feed(const char * i, const char * e) {
+    for (; i != e; ++i) {
+      char c = *i;
+      switch (state_) {
+      case Comment:
+        if (c == '\n') state_ = Space;
+        continue;
+      case Id:
+        if (in_quote_ || escape_ || !(asc_isspace(c) || c == '(' || c == ')' || c == '#')) {
+          id_char(c);
+          continue;
+        }
+        end_id();
+        break;
+      case Colon:
+        state_ = Space;
+        if (c == ':') {
+          // not a flag, just an id starting with "::"
+          start_id();
+          id_char(':');
+          id_char(c);
+          continue;
+        }
+        buf_ += (char)FLAG;
+        if (c != '(') {
+          start_id();
+          if (!(asc_isspace(c) || c == ')' || c == '#')) {
+            id_char(c);
+            continue;
+          }
+          end_id();
+        }
+        break;
+      case Space:
+        break;
+      }
+      // state_ == Space
+      if (asc_isspace(c))
+        ;
+      else if (c == '#')
+        state_ = Comment;
+      else if (c == '(')
+        buf_ += (char)OPEN;
+      else if (c == ')')
+        buf_ += (char)CLOSE;
+      else if (c == ':')
+        state_ = Colon;
+      else {
+        start_id();
+        id_char(c);
+      }
+    }
+  }
+
+  BinaryReader::BinaryReader(const SourceStr & str) 
+    : source(str.source), p(str.begin + sizeof(BINARY_MAGIC)), end(str.end) {}
+
+  unsigned char BinaryReader::tag() {
+    if (p == end) throw error(source, p, "Unexpected end of binary input");
+    return *p++;
+  }
+
+  unsigned BinaryReader::varint() {
+    unsigned v = 0;
+    unsigned shift = 0;
+    unsigned char c;
+    do {
+      c = tag();
+      v |= (c & 0x7F) << shift;
+      shift += 7;
+    } while (c & 0x80);
+    return v;
+  }
+
+  Syntax * BinaryReader::parse() {
+    unsigned char t = tag();
+    if (t != OPEN) throw error(source, p - 1, "Expected '('");
+    return list();
+  }
+
+  Syntax * BinaryReader::list() {
+    SyntaxBuilder res;
+    for (;;) {
+      unsigned char t = tag();
+      if (t == CLOSE)
+        return res.build();
+      else if (t == FLAG)
+        res.add_flag(item(tag()));
+      else
+        res.add_part(item(t));
+    }
+  }
+
+  Syntax * BinaryReader::item(unsigned char t) {
+    switch (t) {
+    case OPEN:
+      return list();
+    case LEAF_NEW: {
+      unsigned size = varint();
+      if ((unsigned)(end - p) < size) throw error(source, p, "Unexpected end of binary input");
+      String name(p, p + size);
+      p += size;
+      syms.push_back(name);
+      return new SyntaxLeaf(name);
+    } case LEAF: {
+      unsigned idx = varint();
+      if (idx >= syms.size()) throw error(source, p, "Bad symbol index in binary input");
+      return new SyntaxLeaf(syms[idx]);
+    } case LEAF_NULL:
+      return new SyntaxLeaf(String());
+    default:
+      throw error(source, p - 1, "Bad tag in binary input");
+    }
+  }
 }
 
 namespace parse_common {
@@ -4,6 +4,10 @@
 #include <stdio.h>
 
 #include "syntax.hpp"
+#include "ostream.hpp"
+#include "string_buf.hpp"
+#include "hash.hpp"
+#include "vector.hpp"
 
 // common structure used for parse results
 
@@ -28,6 +32,58 @@ namespace parse_parse {
   
   Res parse(SourceStr);
 
+  //
+  // Compact binary form of the S-expressions parse() reads, see
+  // parse.cpp for the encoding.
+  //
+
+  bool is_binary(const SourceStr &);
+
+  // Tokenizes the text written to it the same way parse() would and
+  // writes the binary form to OUT, which it owns.
+  class BinaryWriter : public OStream {
+  public:
+    BinaryWriter(OStream * out);
+    ~BinaryWriter();
+    void write(char c) {feed(&c, &c + 1); flush();}
+    void write(ParmStr str) {feed(str, str.str() + str.size()); flush();}
+    void write(const void * data, unsigned int size) {
+      feed((const char *)data, (const char *)data + size); 
+      flush();
+    }
+    int vprintf(const char * format, va_list ap);
+  private:
+    enum State {Space, Comment, Colon, Id};
+    OStream * out_;
+    StringBuf buf_;
+    hash_map<String, unsigned> syms_;
+    State state_;
+    StringBuf tok_;
+    bool in_quote_, have_quotes_, escape_;
+    void feed(const char * i, const char * e);
+    void start_id();
+    void id_char(char c);
+    void end_id();
+    void leaf(String);
+    void varint(unsigned);
+    void flush();
+  };
+
+  struct BinaryReader {
+    const SourceInfo * source;
+    const char * p;
+    const char * end;
+    Vector<String> syms;
+    BinaryReader(const SourceStr &);
+    bool empty() const {return p == end;}
+    Syntax * parse();
+  private:
+    unsigned char tag();
+    unsigned varint();
+    Syntax * item(unsigned char tag);
+    Syntax * list();
+  };
+
 }
 
 #endif
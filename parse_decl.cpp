@@ -31,8 +31,6 @@ void ignore() {}
 
 //static const Syntax * const TYPE = new Syntax("type");
 
-static unsigned uniq_num = 0;
-
 enum Mode {IdRequired, IdNotRequired, StopAtParen};
 
 struct DeclWorking {
@@ -40,7 +38,7 @@ struct DeclWorking {
 
   const Syntax * gen_sym() {
     StringBuf buf;
-    buf.printf("_s_%d_", uniq_num++);
+    buf.printf("_s_%d_", uniq_counters.anon_decl++);
     return SYN(buf.freeze());
   }
 
@@ -383,7 +381,7 @@ const Syntax * ParseDeclImpl::parse_decl(const Syntax * p, Environ & env, bool f
     }
 
     if (decl->str().source != p->str().source)
-      decl->str_ = p->str();
+      decl = with_str(decl, p->str());
     res.add_part(decl);
 
     if (i == end) break;
@@ -416,7 +414,7 @@ const Syntax * ParseDeclImpl::parse_decl(const Syntax * p, Environ & env, bool f
 
   //printf(">OUT>%s\n", ~ret->to_string());
 
-  ret->str_ = p->str();
+  ret = with_str(ret, p->str());
   return ret;
 }
 
@@ -232,9 +232,13 @@ class ParseExpImpl : public ParseExp {
     OpInfo(const Op * o, const Syntax * p)
       : op(o), parse(p) {}
   };
-  Vector<Syntax *> val_s;
-  Vector<OpInfo>   opr_s;
-  String list_is;
+  // The stacks are per call so that separate threads may parse
+  // expressions at the same time
+  struct State {
+    Vector<Syntax *> val_s;
+    Vector<OpInfo>   opr_s;
+    String list_is;
+  };
 public:
 
   void init() {
@@ -249,9 +253,10 @@ public:
   
   const Syntax * parse(const Syntax * p, const char * l_i) {
     //printf("ParseExpImpl::parse: %s %s\n", ~p->sample_w_loc(), ~p->to_string());
-    opr_s.clear();
-    val_s.clear();
-    list_is = l_i;
+    State st;
+    Vector<Syntax *> & val_s = st.val_s;
+    Vector<OpInfo> & opr_s = st.opr_s;
+    st.list_is = l_i;
     Op::Types prev = 0;
     try {
       for (parts_iterator i = p->args_begin(), e = p->args_end(); i != e; ++i) {
@@ -295,7 +300,7 @@ public:
           while (!opr_s.empty() && 
                  (opr_s.back().op->level < op->level || 
                   (opr_s.back().op->level == op->level && op->assoc == Left)))
-            reduce();
+            reduce(st);
           if (!opr_s.empty() && opr_s.back().op->level == op->level && op->assoc == None)
             throw error(pop, "\"%s\" is non-associative.", 
                         op->what.c_str());
@@ -304,7 +309,7 @@ public:
         prev = cur;
       }
       while (!opr_s.empty())
-        reduce();
+        reduce(st);
       if (val_s.size() == 0)
         throw error(p, "Empty expression.");
       if (val_s.size() > 1)
@@ -312,7 +317,7 @@ public:
       assert(val_s.size() == 1);
       Syntax * res = val_s.front();
       if (!res->is_a("syntax") && !res->is_a("raw_syntax"))
-        res->str_ = p->str();
+        res = with_str(res, p->str());
       return res;
     } catch (Error * err) {
       //printf("?? %s %s\n", ~p->sample_w_loc(), ~p->to_string());
@@ -323,12 +328,14 @@ public:
     }
   }
   
-  void reduce() {
+  void reduce(State & st) {
+    Vector<Syntax *> & val_s = st.val_s;
+    Vector<OpInfo> & opr_s = st.opr_s;
     const OpInfo & opi = opr_s.back();
     const Op * op = opi.op;
     SyntaxBuilder res;
     if (op->name == "<list>")
-      res.add_part(SYN(list_is));
+      res.add_part(SYN(st.list_is));
     else
       res.add_part(op->parse);
     SourceStr str = opi.parse->str(); // FIXME: Is this right
@@ -20,6 +20,7 @@
 #include "expand.hpp"
 
 #include "hash-t.hpp"
+#include "profile.hpp"
 
 //#define DUMP_PERFORMANCE_INFO
 
@@ -35,7 +36,7 @@ using std::pair;
 
 struct Prod;
 
-static unsigned indent_level = 0;
+static __thread unsigned indent_level = 0; // for debug output
 
 // FIXME: Need more effect representation for const strings
 //        (Pool of strings, hash lookup, ...)
@@ -136,7 +137,7 @@ struct ProdPropsBase {
 
 // a dependency is represented as a position on the stack frame
 
-unsigned stack_depth = UINT_MAX - 1;
+static __thread unsigned stack_depth = UINT_MAX - 1;
 
 struct ProdProps : public ProdPropsBase {
   // values are only valid if deps is empty
@@ -445,8 +446,6 @@ public:
 };
 
 
-unsigned run_id = 1; // persistent prod always have a run_id of 0
-
 struct CachedProd;
 struct CacheKey {
   const CachedProd * prod;
@@ -464,7 +463,14 @@ bool operator==(const CacheKey & x, const CacheKey & y) {
   return x.prod == y.prod && x.str == y.str;
 }
 
-struct CacheData : public tiny_hash<hash_map<CacheKey,Res>,2,32> {};
+// run_id is bumped each time the memo table is reused so that entries
+// from a previous parse are ignored, persistent prods always have a
+// run_id of 0
+struct CacheData : public tiny_hash<hash_map<CacheKey,Res>,2,32> {
+  GC_ALLOC_CATEGORY(ALLOC_PACKRAT)
+  unsigned run_id;
+  CacheData() : run_id(1) {}
+};
 
 struct Cache {
   typedef CacheKey Key;
@@ -473,7 +479,7 @@ struct Cache {
   Cache() : data() {}
   void reset(Data * p) {
     pprintf("NamedProd CLEAR\n");
-    run_id++;
+    p->run_id++;
     data = p;
   }
   struct LookupRes {
@@ -557,10 +563,11 @@ private:
 };
 
 Cache::LookupRes Cache::lookup(const CachedProd * prod, SourceStr str) {
+  GcAllocCategory alloc_cat(ALLOC_PACKRAT);
   pair<Data::value_type *, bool> 
     cached = data->insert(Key(prod, str.begin));
   Res & r = cached.first->second;
-  unsigned run_id = prod->persistent() ? 0 : ::run_id;
+  unsigned run_id = prod->persistent() ? 0 : data->run_id;
   if (cached.second) {
     r.run_id = run_id;
     return LookupRes(r, false);
@@ -633,6 +640,7 @@ namespace ParsePeg {
     Vector< Sym<NamedProd> > unresolved_syms;
     Vector< Sym<TokenProd> > token_syms;
     ProdWrap                 existing; // used when redefining
+    String                   cur_named_prod;
 
     void top(const char * str, const char * end);
 
@@ -761,7 +769,7 @@ MatchRes SymProd::match(SourceStr str, SynBuilder * parts, MatchEnviron & env) c
   MatchRes r = prod.match(str,parts,env);
   if (!r) return r;
   if (!prod.capture)
-    parts->add_part(SYN(String(str.begin, r), str, r));
+    parts->add_part(SYN(syntax_ns::intern_str(str.begin, r), str, r));
   return r;
 }
 
@@ -829,10 +837,16 @@ MatchRes CachedProd::match_i(SourceStr str, SynBuilder * parts, Res * given_res,
   }
   if (parts) {
     if (!prod.capture && r->end)
-      r->res.add_part(SYN(String(str.begin, r->end), str, r->end));
+      r->res.add_part(SYN(syntax_ns::intern_str(str.begin, r->end), str, r->end));
     parts->add_parts(r->res.parts_begin(), r->res.parts_end());
     parts->merge_flags(r->res.flags_begin(), r->res.flags_end());
   }
+  if (!given_res) {
+    // the memo entry is never destroyed so don't let it hold on to
+    // scratch storage
+    GcAllocCategory alloc_cat(ALLOC_PACKRAT);
+    r->res.unpool();
+  }
   //printf("%*cMATCH %s RES = %p\n", indent_level, ' ', ~name, r->end);
   return r->end;
 }
@@ -875,7 +889,7 @@ public:
     if (!res) return prod.match(str, NULL, env);
     MatchRes r = prod.match(str, NULL, env);
     if (!r) return r;
-    Syntax * parse = SYN(String(str.begin, r), str, r);
+    Syntax * parse = SYN(syntax_ns::intern_str(str.begin, r), str, r);
     //printf("NONE: %s\n", ~parse->to_string());
     res->add_part(parse);
     return r;
@@ -1217,7 +1231,8 @@ public:
     if (!r) return r;
     assert(res.num_parts() == 1);
     ReparseSyntax * syn = const_cast<ReparseSyntax *>(res.part(0)->as_reparse());
-    syn->str_ = syn->outer_ = SourceStr(str, r);
+    syn->outer_ = SourceStr(str, r);
+    syn->set_str(syn->outer_);
     syn->what_ = name;
     syn->parse_as = parse_as;
     //printf("ro: %s %s\n", ~syn->rwhat().name, syn->parse_as ? ~String(syn->parse_as) : NULL);
@@ -1854,8 +1869,6 @@ ret: 0;
   finalized = true;
 }
 
-String cur_named_prod;
-
 class S_MId : public Prod {
 public:
   MatchRes match(SourceStr str, SynBuilder * res, MatchEnviron & env) const {
@@ -1904,8 +1917,8 @@ public:
     }
 
   }
-  S_MId(const SourceStr & s, const ProdWrap & p, String inp = String())
-    : Prod(s), in_named_prod(inp.empty() ? cur_named_prod : inp), prod(new NamedCapture(s, p, "mid")) {capture_type = ExplicitCapture;}
+  S_MId(const SourceStr & s, const ProdWrap & p, String inp)
+    : Prod(s), in_named_prod(inp), prod(new NamedCapture(s, p, "mid")) {capture_type = ExplicitCapture;}
   S_MId(const S_MId & o, Prod * p = 0)
     : Prod(o), in_named_prod(o.in_named_prod), prod(o.prod.clone(p)) {}
   S_MId(const S_MId & o, Mapper m)
@@ -2091,6 +2104,8 @@ const Syntax * parse_prod(String what, SourceStr & str, ParseInfo p_i,
   pprintf("BEGIN %s: (%p) %s\n", ~what, str.begin, ~sample(str.begin, str.end));
   //printf("PARSE STR %.*s as %s\n", str.end - str.begin, str.begin, ~what);
   //clock_t start = clock();
+  TimePhase phase("parse");
+  TraceScope trace("parse", ~what, str.source, str.begin);
   MatchEnviron env;
   env.peg = p_i.peg;
   env.mids = repls;
@@ -2416,7 +2431,8 @@ namespace ParsePeg {
     if (sp == SP_NAME_LATER)
       return Res(new PlaceHolderCapture(mk_src(start, str), prod));
     else if (sp == SP_MID)
-      return Res(new S_MId(mk_src(start, str), prod, String(special[1])));
+      return Res(new S_MId(mk_src(start, str), prod, 
+                           String(special[1]).empty() ? cur_named_prod : String(special[1])));
     else if (sp == SP_REPARSE)
       return Res(new ReparseOuter(mk_src(start, str), 
                                   prod.prod, name, special[2] ? String(special[2]) : String()));
@@ -24,6 +24,14 @@ struct ParseAsQuasiQuote {
   operator bool() const {return answer;}
 };
 
+// parse_prod is reentrant so separate threads may parse separate
+// files at the same time.  The memo table belongs to the ParseInfo (a
+// new one is used if it has none) and the rest of the parser state is
+// per thread or per call.  A PEG is read only once parse_peg or
+// extend_peg returns and may be shared, but a ParseInfo cache must not
+// be used by more than one thread at once.  parse_stmts and macro
+// expansion are single-threaded: separate ast::Environs may be used
+// one after the other, but not from separate threads at once.
 const Syntax * parse_prod(String what, SourceStr & str, ParseInfo,
                           ast::Environ * ast_env = NULL,
                           const Replacements * repls = NULL, 
@@ -0,0 +1,575 @@
+#include <time.h>
+#include <malloc.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <execinfo.h>
+#include <errno.h>
+
+#include <cxxabi.h>
+#include <algorithm>
+
+#include "profile.hpp"
+#include "syntax.hpp"
+#include "string_buf.hpp"
+#include "hash-t.hpp"
+
+#ifndef NO_GC
+extern "C" size_t GC_get_total_bytes();
+#endif
+
+bool macro_profile_enabled = false;
+
+size_t alloc_bytes() {
+#ifdef NO_GC
+  // nothing allocated with GC_MALLOC is ever freed so the number of
+  // bytes in use is close enough
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+#else
+  return GC_get_total_bytes();
+#endif
+}
+
+static unsigned long long now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+struct MacroProfileEntry {
+  const char * name;
+  const char * kind;
+  unsigned count;
+  unsigned long long incl_time;
+  unsigned long long excl_time;
+  unsigned long long bytes;
+  unsigned long long nodes;
+  MacroProfileEntry() 
+    : name(), kind(), count(), incl_time(), excl_time(), bytes(), nodes() {}
+};
+
+struct MacroProfileFrame {
+  MacroProfileEntry * entry;
+  String stack;
+  unsigned long long start;
+  unsigned long long child_time;
+  size_t start_bytes;
+  MacroProfileFrame() : entry(), start(), child_time(), start_bytes() {}
+};
+
+static hash_map<const void *, MacroProfileEntry> entries;
+static hash_map<String, unsigned long long> stacks;
+static Vector<MacroProfileFrame> frames;
+
+// Count the nodes in a syntax object without forcing any reparse
+static unsigned long long syntax_size(const Syntax * p) {
+  if (!p) return 0;
+  if (p->is_reparse() || p->no_parts()) return 1;
+  unsigned long long sz = 1;
+  for (parts_iterator i = p->parts_begin(), e = p->parts_end(); i != e; ++i)
+    sz += syntax_size(*i);
+  for (flags_iterator i = p->flags_begin(), e = p->flags_end(); i != e; ++i)
+    sz += syntax_size(*i);
+  return sz;
+}
+
+void macro_profile_enter(const void * macro, const char * name, const char * kind) {
+  MacroProfileEntry & entry = entries[macro];
+  if (!entry.name) {
+    entry.name = name;
+    entry.kind = kind;
+  }
+  MacroProfileFrame f;
+  f.entry = &entry;
+  if (frames.empty()) {
+    f.stack = name;
+  } else {
+    StringBuf buf;
+    buf << frames.back().stack << ";" << name;
+    f.stack = buf.freeze();
+  }
+  f.start_bytes = alloc_bytes();
+  f.start = now_ns();
+  frames.push_back(f);
+}
+
+void macro_profile_leave(const Syntax * res) {
+  unsigned long long end = now_ns();
+  MacroProfileFrame & f = frames.back();
+  unsigned long long incl = end - f.start;
+  unsigned long long excl = incl - f.child_time;
+  MacroProfileEntry & entry = *f.entry;
+  entry.count++;
+  entry.excl_time += excl;
+  entry.bytes += alloc_bytes() - f.start_bytes;
+  entry.nodes += syntax_size(res);
+  // don't count recursive expansions twice
+  bool recursive = false;
+  for (unsigned i = 0; i + 1 < frames.size(); ++i)
+    if (frames[i].entry == f.entry) recursive = true;
+  if (!recursive)
+    entry.incl_time += incl;
+  stacks[f.stack] += excl;
+  frames.pop_back();
+  if (!frames.empty())
+    frames.back().child_time += incl;
+}
+
+struct InclTimeGt {
+  bool operator() (const MacroProfileEntry * x, const MacroProfileEntry * y) const {
+    return x->incl_time > y->incl_time;
+  }
+};
+
+void macro_profile_report(FILE * out) {
+  Vector<const MacroProfileEntry *> sorted;
+  unsigned long long total = 0;
+  for (hash_map<const void *, MacroProfileEntry>::const_iterator 
+         i = entries.begin(), e = entries.end(); i != e; ++i)
+  {
+    sorted.push_back(&i->second);
+    total += i->second.excl_time;
+  }
+  std::sort(sorted.begin(), sorted.end(), InclTimeGt());
+  fprintf(out, "Macro expansion profile (%u macros, %.3f s total)\n", 
+          (unsigned)sorted.size(), total / 1e9);
+  fprintf(out, "%10s %10s %10s %6s %12s %10s  %s\n",
+          "count", "incl ms", "excl ms", "excl%", "bytes", "nodes", "macro");
+  for (Vector<const MacroProfileEntry *>::const_iterator 
+         i = sorted.begin(), e = sorted.end(); i != e; ++i)
+  {
+    const MacroProfileEntry * m = *i;
+    fprintf(out, "%10u %10.3f %10.3f %6.2f %12llu %10llu  %s (%s)\n",
+            m->count, m->incl_time / 1e6, m->excl_time / 1e6, 
+            total ? 100.0 * m->excl_time / total : 0.0,
+            m->bytes, m->nodes, m->name, m->kind);
+  }
+}
+
+void macro_profile_write_stacks(const char * file_name) {
+  FILE * out = fopen(file_name, "w");
+  if (!out) {
+    perror(file_name);
+    return;
+  }
+  for (hash_map<String, unsigned long long>::const_iterator 
+         i = stacks.begin(), e = stacks.end(); i != e; ++i)
+  {
+    fprintf(out, "%s %llu\n", ~i->first, i->second / 1000);
+  }
+  fclose(out);
+}
+
+//
+// Phase timing
+//
+
+bool time_report_enabled = false;
+
+struct TimePhaseEntry : public gc {
+  String name;
+  unsigned count;
+  unsigned long long self_time;
+  unsigned long long incl_time;
+  unsigned long long child_time;
+  unsigned long long bytes;
+  long peak_rss; // in KB
+  TimePhaseEntry() 
+    : count(), self_time(), incl_time(), child_time(), bytes(), peak_rss() {}
+};
+
+struct TimePhaseFrame {
+  TimePhaseEntry * entry;
+  unsigned long long start;
+  unsigned long long nested_time;
+  unsigned long long start_child;
+  unsigned long long nested_child;
+  size_t start_bytes;
+  size_t nested_bytes;
+};
+
+static hash_map<String, unsigned> phase_idx;
+static Vector<TimePhaseEntry *> phases; // in the order first entered
+static Vector<TimePhaseFrame> phase_frames;
+
+// CPU time used by waited for children in nanoseconds
+static unsigned long long child_ns() {
+  struct rusage ru;
+  getrusage(RUSAGE_CHILDREN, &ru);
+  return (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000000ull
+    + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) * 1000ull;
+}
+
+static long peak_rss_kb() {
+  struct rusage ru;
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_maxrss;
+}
+
+void time_phase_enter(const char * name0) {
+  String name = name0;
+  hash_map<String, unsigned>::iterator i = phase_idx.find(name);
+  if (i == phase_idx.end()) {
+    TimePhaseEntry * entry = new TimePhaseEntry;
+    entry->name = name;
+    i = phase_idx.insert(name, phases.size()).first;
+    phases.push_back(entry);
+  }
+  TimePhaseFrame f;
+  f.entry = phases[i->second];
+  f.nested_time = 0;
+  f.nested_child = 0;
+  f.nested_bytes = 0;
+  f.start_bytes = alloc_bytes();
+  f.start_child = child_ns();
+  f.start = now_ns();
+  phase_frames.push_back(f);
+}
+
+void time_phase_leave() {
+  unsigned long long end = now_ns();
+  TimePhaseFrame & f = phase_frames.back();
+  unsigned long long incl = end - f.start;
+  unsigned long long child = child_ns() - f.start_child;
+  size_t bytes = alloc_bytes() - f.start_bytes;
+  TimePhaseEntry & entry = *f.entry;
+  entry.count++;
+  entry.self_time += incl - f.nested_time;
+  entry.child_time += child - f.nested_child;
+  entry.bytes += bytes - f.nested_bytes;
+  long rss = peak_rss_kb();
+  if (rss > entry.peak_rss) entry.peak_rss = rss;
+  bool recursive = false;
+  for (unsigned i = 0; i + 1 < phase_frames.size(); ++i)
+    if (phase_frames[i].entry == f.entry) recursive = true;
+  if (!recursive)
+    entry.incl_time += incl;
+  phase_frames.pop_back();
+  if (!phase_frames.empty()) {
+    TimePhaseFrame & p = phase_frames.back();
+    p.nested_time += incl;
+    p.nested_child += child;
+    p.nested_bytes += bytes;
+  }
+}
+
+void time_report(FILE * out) {
+  unsigned long long total = 0;
+  for (unsigned i = 0; i != phases.size(); ++i)
+    total += phases[i]->self_time;
+  fprintf(out, "Time report (%.3f s total, %ld KB peak RSS)\n", 
+          total / 1e9, peak_rss_kb());
+  fprintf(out, "%8s %10s %6s %10s %10s %12s %10s  %s\n",
+          "count", "self ms", "self%", "incl ms", "child ms", "bytes", "peak KB", "phase");
+  for (unsigned i = 0; i != phases.size(); ++i) {
+    const TimePhaseEntry * p = phases[i];
+    fprintf(out, "%8u %10.3f %6.2f %10.3f %10.3f %12llu %10ld  %s\n",
+            p->count, p->self_time / 1e6, 
+            total ? 100.0 * p->self_time / total : 0.0,
+            p->incl_time / 1e6, p->child_time / 1e6,
+            p->bytes, p->peak_rss, ~p->name);
+  }
+}
+
+static void json_str(FILE * out, const char * s) {
+  fputc('"', out);
+  for (; *s; ++s) {
+    if (*s == '"' || *s == '\\') fputc('\\', out);
+    if ((unsigned char)*s < 0x20) fprintf(out, "\\u%04x", *s);
+    else fputc(*s, out);
+  }
+  fputc('"', out);
+}
+
+void time_report_json(FILE * out) {
+  unsigned long long total = 0;
+  for (unsigned i = 0; i != phases.size(); ++i)
+    total += phases[i]->self_time;
+  fprintf(out, "{\"total_ns\": %llu, \"peak_rss_kb\": %ld, \"phases\": [", 
+          total, peak_rss_kb());
+  for (unsigned i = 0; i != phases.size(); ++i) {
+    const TimePhaseEntry * p = phases[i];
+    fprintf(out, "%s\n  {\"name\": ", i == 0 ? "" : ",");
+    json_str(out, ~p->name);
+    fprintf(out, ", \"count\": %u, \"self_ns\": %llu, \"incl_ns\": %llu, "
+            "\"child_ns\": %llu, \"bytes\": %llu, \"peak_rss_kb\": %ld}",
+            p->count, p->self_time, p->incl_time, p->child_time, p->bytes, p->peak_rss);
+  }
+  fprintf(out, "\n]}\n");
+}
+
+//
+// Trace events
+//
+
+struct TraceEventRec {
+  const char * cat;
+  const char * name;
+  const SourceInfo * source;
+  const char * pos;
+  unsigned long long start;
+  unsigned long long end;
+  unsigned tid;
+};
+
+static const char * trace_file = getenv("ZL_TRACE");
+bool trace_enabled = trace_file && *trace_file;
+
+static TraceEventRec * trace_buf = NULL;
+static unsigned trace_mask = 0;
+static unsigned long long trace_next = 0; // total number of events recorded
+static unsigned trace_tids = 0;
+static __thread unsigned trace_tid = 0;
+
+static void trace_write();
+
+static struct TraceInit {
+  TraceInit() {
+    if (!trace_enabled) return;
+    const char * s = getenv("ZL_TRACE_EVENTS");
+    long n = s ? strtol(s, NULL, 10) : 1 << 20;
+    unsigned sz = 1;
+    while (sz < n && sz < 1u << 31) sz *= 2;
+    trace_mask = sz - 1;
+    // the events hold on to names and source files
+    trace_buf = (TraceEventRec *)GC_MALLOC_UNCOLLECTABLE(sz * sizeof(TraceEventRec));
+    atexit(trace_write);
+  }
+} trace_init;
+
+unsigned long long trace_now() {
+  return now_ns();
+}
+
+void trace_event(const char * cat, const char * name, unsigned long long start,
+                 const SourceInfo * source, const char * pos)
+{
+  if (!trace_tid) trace_tid = __sync_add_and_fetch(&trace_tids, 1);
+  unsigned long long i = __sync_fetch_and_add(&trace_next, 1);
+  TraceEventRec & e = trace_buf[i & trace_mask];
+  e.cat = cat;
+  e.name = name;
+  e.source = source;
+  e.pos = pos;
+  e.start = start;
+  e.end = now_ns();
+  e.tid = trace_tid;
+}
+
+static void trace_write() {
+  FILE * out = fopen(trace_file, "w");
+  if (!out) {
+    perror(trace_file);
+    return;
+  }
+  unsigned long long num = trace_next, sz = trace_mask + 1ull;
+  unsigned long long first = num > sz ? num - sz : 0;
+  unsigned long long base = ~0ull;
+  for (unsigned long long i = first; i != num; ++i)
+    if (trace_buf[i & trace_mask].start < base) base = trace_buf[i & trace_mask].start;
+  int pid = getpid();
+  fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+  for (unsigned long long i = first; i != num; ++i) {
+    const TraceEventRec & e = trace_buf[i & trace_mask];
+    fprintf(out, "%s\n{\"ph\": \"X\", \"cat\": ", i == first ? "" : ",");
+    json_str(out, e.cat);
+    fprintf(out, ", \"name\": ");
+    json_str(out, e.name ? e.name : "");
+    fprintf(out, ", \"pid\": %d, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f",
+            pid, e.tid, (e.start - base) / 1e3, (e.end - e.start) / 1e3);
+    StringBuf loc;
+    if (e.pos && pos_str(e.source, e.pos, "", loc, "")) {
+      fprintf(out, ", \"args\": {\"loc\": ");
+      json_str(out, ~loc.freeze());
+      fprintf(out, "}");
+    }
+    fprintf(out, "}");
+  }
+  fprintf(out, "\n]}\n");
+  if (num > sz)
+    fprintf(stderr, "zl: trace buffer overflowed, %llu oldest events dropped\n", first);
+  fclose(out);
+}
+
+//
+// Allocation accounting
+//
+
+#ifdef NO_GC
+
+GcAllocCount gc_alloc_counts[ALLOC_NUM_CATS];
+__thread GcAllocCat gc_alloc_cat = ALLOC_OTHER;
+unsigned gc_alloc_sample_period = 0;
+__thread unsigned gc_alloc_sample_count = 0;
+
+static const char * const alloc_cat_names[ALLOC_NUM_CATS] = 
+  {"other", "Syntax", "SymbolNode", "packrat cache", "String", "AST", "types", "marks"};
+
+static const unsigned ALLOC_STACK_DEPTH = 32;
+
+struct AllocSample {
+  GcAllocCat cat;
+  int depth;
+  size_t size;
+  void * frames[ALLOC_STACK_DEPTH];
+};
+
+static const char * alloc_stacks_file = NULL;
+static Vector<AllocSample> alloc_samples;
+static volatile int alloc_samples_lock = 0;
+static __thread bool in_alloc_sample = false;
+
+void gc_alloc_sample(size_t size, GcAllocCat cat) {
+  if (in_alloc_sample) return;
+  in_alloc_sample = true;
+  AllocSample s;
+  s.cat = cat;
+  s.size = size;
+  s.depth = backtrace(s.frames, ALLOC_STACK_DEPTH);
+  while (__sync_lock_test_and_set(&alloc_samples_lock, 1));
+  alloc_samples.push_back(s);
+  __sync_lock_release(&alloc_samples_lock);
+  in_alloc_sample = false;
+}
+
+void alloc_report(FILE * out) {
+  GcAllocCount total = {0, 0};
+  Vector<unsigned> order;
+  for (unsigned i = 0; i != ALLOC_NUM_CATS; ++i) {
+    total.bytes += gc_alloc_counts[i].bytes;
+    total.objects += gc_alloc_counts[i].objects;
+    order.push_back(i);
+  }
+  for (unsigned i = 1; i < order.size(); ++i)
+    for (unsigned j = i; j > 0 && gc_alloc_counts[order[j]].bytes > gc_alloc_counts[order[j-1]].bytes; --j)
+      std::swap(order[j], order[j-1]);
+  fprintf(out, "Allocations (%llu bytes in %llu objects, %zu bytes of malloc in use)\n",
+          total.bytes, total.objects, alloc_bytes());
+  fprintf(out, "%12s %14s %6s  %s\n", "objects", "bytes", "%", "category");
+  for (unsigned i = 0; i != order.size(); ++i) {
+    const GcAllocCount & c = gc_alloc_counts[order[i]];
+    fprintf(out, "%12llu %14llu %6.2f  %s\n", c.objects, c.bytes, 
+            total.bytes ? 100.0 * c.bytes / total.bytes : 0.0, alloc_cat_names[order[i]]);
+  }
+}
+
+// The function name of a return address, demangled if possible
+static String frame_name(void * addr) {
+  char * * syms = backtrace_symbols(&addr, 1);
+  StringBuf buf;
+  const char * b = syms ? strchr(syms[0], '(') : NULL;
+  const char * e = b ? strpbrk(b, "+)") : NULL;
+  if (b && e && e > b + 1) {
+    String mangled(b + 1, e);
+    int status;
+    char * demangled = abi::__cxa_demangle(~mangled, NULL, NULL, &status);
+    buf << (demangled ? demangled : ~mangled);
+    free(demangled);
+  } else {
+    buf.printf("%p", addr);
+  }
+  free(syms);
+  for (char * i = buf.begin(), * e = buf.end(); i != e; ++i)
+    if (*i == ';') *i = ':';
+  return buf.freeze();
+}
+
+static void alloc_write_stacks() {
+  unsigned period = gc_alloc_sample_period;
+  gc_alloc_sample_period = 0;
+  FILE * out = fopen(alloc_stacks_file, "w");
+  if (!out) {
+    perror(alloc_stacks_file);
+    return;
+  }
+  hash_map<const void *, String> names;
+  hash_map<String, unsigned long long> stacks;
+  for (unsigned i = 0; i != alloc_samples.size(); ++i) {
+    const AllocSample & s = alloc_samples[i];
+    StringBuf buf;
+    // frame 0 is gc_alloc_sample
+    for (int j = s.depth - 1; j > 0; --j) {
+      hash_map<const void *, String>::iterator n = names.find(s.frames[j]);
+      if (n == names.end())
+        n = names.insert(s.frames[j], frame_name(s.frames[j])).first;
+      if (n->second.size() > 3 && strncmp(~n->second, "gc_", 3) == 0) continue;
+      buf << n->second << ";";
+    }
+    buf << "[" << alloc_cat_names[s.cat] << "]";
+    stacks[buf.freeze()] += (unsigned long long)s.size * period;
+  }
+  for (hash_map<String, unsigned long long>::iterator i = stacks.begin(), e = stacks.end(); i != e; ++i)
+    fprintf(out, "%s %llu\n", ~i->first, i->second);
+  fclose(out);
+}
+
+static void alloc_report_at_exit() {
+  alloc_report(stderr);
+}
+
+// Only async-signal-safe functions may be used in a signal handler,
+// so the report is formatted by hand into a stack buffer and written
+// with write(2).
+static char * append_uint(char * p, unsigned long long v, unsigned width) {
+  char tmp[24];
+  unsigned n = 0;
+  do {tmp[n++] = '0' + v % 10; v /= 10;} while (v);
+  for (; width > n; --width) *p++ = ' ';
+  while (n) *p++ = tmp[--n];
+  return p;
+}
+
+static char * append_str(char * p, const char * str) {
+  while (*str) *p++ = *str++;
+  return p;
+}
+
+static void alloc_report_on_signal(int) {
+  int saved_errno = errno;
+  char buf[64 * (ALLOC_NUM_CATS + 2)];
+  char * p = append_str(buf, "Allocations\n     objects          bytes  category\n");
+  for (unsigned i = 0; i != ALLOC_NUM_CATS; ++i) {
+    p = append_uint(p, gc_alloc_counts[i].objects, 12);
+    *p++ = ' ';
+    p = append_uint(p, gc_alloc_counts[i].bytes, 14);
+    p = append_str(p, "  ");
+    p = append_str(p, alloc_cat_names[i]);
+    *p++ = '\n';
+  }
+  const char * i = buf;
+  while (i != p) {
+    ssize_t n = write(STDERR_FILENO, i, p - i);
+    if (n > 0) i += n;
+    else if (n == -1 && errno == EINTR) continue;
+    else break;
+  }
+  errno = saved_errno;
+}
+
+static struct AllocStatsInit {
+  AllocStatsInit() {
+    if (getenv("ZL_ALLOC_REPORT")) {
+      atexit(alloc_report_at_exit);
+      signal(SIGUSR1, alloc_report_on_signal);
+    }
+    alloc_stacks_file = getenv("ZL_ALLOC_STACKS");
+    if (alloc_stacks_file && *alloc_stacks_file) {
+      const char * s = getenv("ZL_ALLOC_SAMPLE");
+      long n = s ? strtol(s, NULL, 10) : 4096;
+      gc_alloc_sample_period = n > 0 ? n : 1;
+      atexit(alloc_write_stacks);
+    }
+  }
+} alloc_stats_init;
+
+#else
+
+void alloc_report(FILE * out) {
+  fprintf(out, "Allocation accounting is only available when built with NO_GC\n");
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef PROFILE__HPP
+#define PROFILE__HPP
+
+#include <stdio.h>
+
+#include "util.hpp"
+
+// Per-macro expansion profiling, enabled with "-macro-profile".  For
+// every macro the number of expansions, inclusive and exclusive time,
+// bytes allocated (inclusive) and the size of the resulting syntax is
+// recorded.
+
+extern bool macro_profile_enabled;
+
+void macro_profile_enter(const void * macro, const char * name, const char * kind);
+void macro_profile_leave(const Syntax * res);
+
+// Sorted, human readable, report
+void macro_profile_report(FILE *);
+
+// Stack dump of nested expansion, one line per unique stack with the
+// exclusive time in microseconds, as expected by flamegraph.pl
+void macro_profile_write_stacks(const char * file_name);
+
+// Bytes allocated by the GC_MALLOC family so far
+size_t alloc_bytes();
+
+// Bytes and objects allocated in each category, only available
+// without a collector, see gc.hpp.  Printed at exit if ZL_ALLOC_REPORT
+// is set, in which case SIGUSR1 also prints the counts (unsorted and
+// without the malloc total).  If ZL_ALLOC_STACKS is set
+// to a file name every ZL_ALLOC_SAMPLE'th allocation (default 4096)
+// records its call stack and at exit the estimated bytes allocated
+// by each stack are written to the file in the format expected by
+// flamegraph.pl.
+void alloc_report(FILE *);
+
+struct MacroProfileGuard {
+  bool active;
+  MacroProfileGuard(const void * macro, const char * name, const char * kind) 
+    : active(macro_profile_enabled) 
+    {if (active) macro_profile_enter(macro, name, kind);}
+  void done(const Syntax * res) {
+    if (active) macro_profile_leave(res);
+    active = false;
+  }
+  ~MacroProfileGuard() {done(NULL);}
+};
+
+// Phase timing, enabled with "-ftime-report".  Phases nest and the
+// self time, bytes allocated and child process time of a phase do
+// not include any nested phase.  The inclusive time only counts the
+// outermost instance of a phase.  Peak memory is the maximum resident
+// set size seen when the phase was left.
+
+extern bool time_report_enabled;
+
+void time_phase_enter(const char * name);
+void time_phase_leave();
+
+// Table of the phases in the order first entered
+void time_report(FILE *);
+
+// The same information as JSON
+void time_report_json(FILE *);
+
+// Takes a plain string so that nothing is allocated unless the
+// report is enabled
+struct TimePhase {
+  bool active;
+  TimePhase(const char * name) : active(time_report_enabled) 
+    {if (active) time_phase_enter(name);}
+  ~TimePhase() {if (active) time_phase_leave();}
+};
+
+// Chrome trace event output, enabled by setting ZL_TRACE to the name
+// of the file to write at exit (load it in chrome://tracing or
+// Perfetto).  Events are kept in a fixed size ring buffer, of
+// ZL_TRACE_EVENTS entries (default 1M), so if it fills up only the
+// most recent events are written.  Recording an event is lock free so
+// parsing in several threads can be traced.
+
+struct SourceInfo;
+
+extern bool trace_enabled;
+
+unsigned long long trace_now();
+
+// Record an event that started at START and ends now, SOURCE and POS,
+// if given, are only turned into a location when the trace is written
+void trace_event(const char * cat, const char * name, unsigned long long start,
+                 const SourceInfo * source = NULL, const char * pos = NULL);
+
+struct TraceScope {
+  const char * cat;
+  const char * name;
+  const SourceInfo * source;
+  const char * pos;
+  unsigned long long start; // 0 when not tracing
+  TraceScope(const char * c, const char * n, 
+             const SourceInfo * s = NULL, const char * p = NULL)
+    : cat(c), name(n), source(s), pos(p), start(trace_enabled ? trace_now() : 0) {}
+  // The location of SYN, only looked up when tracing
+  template <typename T>
+  TraceScope(const char * c, const char * n, const T * syn)
+    : cat(c), name(n), source(), pos(), start(trace_enabled ? trace_now() : 0) 
+    {if (start) at(syn->str());}
+  template <typename Str>
+  void at(const Str & str) {source = str.source; pos = str.begin;}
+  ~TraceScope() {if (start) trace_event(cat, name, start, source, pos);}
+};
+
+#endif
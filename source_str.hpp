@@ -123,29 +123,47 @@ private:
   char * data_;
   unsigned size_;
   bool pp_mode; // pp = preprocess
+  bool mapped_; // data_ is mmaped rather than malloced
   Vector<SourceChange> source_change;
-  Vector<const char *> lines_;
+  mutable Vector<const char *> lines_; // created on demand by get_pos
+  // cursor used by get_pos, see find_line
+  mutable unsigned last_line_;
+  mutable unsigned last_sc_;
+  mutable unsigned last_sc_line_;
 public:
   bool internal;
   SourceBlock base_block;
   SourceFile(String file, bool cpm = false) 
-    : data_(), size_(0), pp_mode(cpm), internal(false),
+    : data_(), size_(0), pp_mode(cpm), mapped_(false), 
+      last_line_(0), last_sc_(0), last_sc_line_(NPOS), internal(false),
       base_block(this)
     {read(file);}
   SourceFile(int fd, bool cpm = false) 
-    : data_(), size_(0), pp_mode(cpm), internal(false),
+    : data_(), size_(0), pp_mode(cpm), mapped_(false), 
+      last_line_(0), last_sc_(0), last_sc_line_(NPOS), internal(false),
       base_block(this)
     {read(fd);}
+  SourceFile(String name, const char * data, unsigned size, bool cpm = false) 
+    : file_name_(name), data_(), size_(0), pp_mode(cpm), mapped_(false), 
+      last_line_(0), last_sc_(0), last_sc_line_(NPOS), internal(false),
+      base_block(this)
+    {read(data, size);}
   String file_name() const {return file_name_;}
   Pos get_pos(const char * s) const;
   inline void get_pos_str(const char * s, OStream & buf) const;
   unsigned size() const {return size_;}
   const char * begin() const {return data_;}
   const char * end() const {return data_ + size_;}
-  ~SourceFile() {if (data_) free(data_);}
+  ~SourceFile();
 private:
   void read(String file);
   void read(int fd);
+  void read(const char * data, unsigned size);
+  bool map(int fd);
+  void find_source_changes();
+  void index_lines() const;
+  unsigned find_line(const char * s) const;
+  unsigned find_source_change(const char * s) const;
   SourceFile(const SourceFile &);
   void operator=(const SourceFile &);
 };
@@ -174,6 +192,9 @@ SourceFile * new_source_file(String file, const SourceFile * included_from = NUL
 
 SourceFile * new_source_file(int fd, bool pp_mode = false);
 
+// Copies DATA, NAME is only used for error messages
+SourceFile * new_source_file(String name, const char * data, unsigned size, bool pp_mode = false);
+
 bool pos_str(const SourceFile * source, const char * pos,
              const char * pre, OStream & o, const char * post);
 
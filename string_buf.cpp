@@ -20,9 +20,9 @@
     if (new_size < s + 1) new_size = s + 1;
     if (old_size == 0) {
       if (d) GC_FREE(d);
-      d = (StringObj *)GC_MALLOC_ATOMIC(sizeof(StringObj) + new_size);
+      d = (StringObj *)GC_MALLOC_ATOMIC_CAT(sizeof(StringObj) + new_size, ALLOC_STRING);
     } else {
-      StringObj * d2 = (StringObj *)GC_MALLOC_ATOMIC(sizeof(StringObj) + new_size);
+      StringObj * d2 = (StringObj *)GC_MALLOC_ATOMIC_CAT(sizeof(StringObj) + new_size, ALLOC_STRING);
       memcpy(d2->str, d->str, old_size);
       GC_FREE(d);
       d = d2;
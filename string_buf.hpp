@@ -23,7 +23,7 @@ private:
 
   void assign_only_nonnull(const char * b, unsigned size)
   {
-    d = (StringObj *)GC_MALLOC_ATOMIC(sizeof(StringObj) + size + 1);
+    d = (StringObj *)GC_MALLOC_ATOMIC_CAT(sizeof(StringObj) + size + 1, ALLOC_STRING);
     d->size = 0;
     begin_ = d->str;
     memmove(begin_, b, size);
@@ -187,6 +187,18 @@ public:
       ++end_;
       return *this;
     }
+    StringBuf & append_uint(unsigned long long n)
+    {
+      char buf[FORMAT_INT_MAX], * end = buf + FORMAT_INT_MAX;
+      char * b = format_uint(end, n);
+      return append(b, end - b);
+    }
+    StringBuf & append_int(long long n)
+    {
+      char buf[FORMAT_INT_MAX], * end = buf + FORMAT_INT_MAX;
+      char * b = format_int(end, n);
+      return append(b, end - b);
+    }
 
     StringBuf & operator+= (const char * s) {
       append(s);
@@ -357,6 +369,14 @@ public:
       append(c);
       return *this;
     }
+
+    StringBuf & operator << (unsigned n) {
+      return append_uint(n);
+    }
+
+    StringBuf & operator << (int n) {
+      return append_int(n);
+    }
 };
 
   inline StringBuf operator+ (ParmStr lhs, ParmStr rhs)
@@ -68,15 +68,44 @@ namespace ast {
 
   unsigned Mark::last_id = 0;
 
+  // Marks created by static initializers are shared between threads
+  // so the caches hanging off them are guarded by a spin lock.  It is
+  // not held while creating a new mark set as that may add other
+  // marks, if another thread creates the same set first its result
+  // is used.
+  static volatile int mark_cache_lock = 0;
+
+  struct MarkCacheLock {
+    MarkCacheLock() {while (__sync_lock_test_and_set(&mark_cache_lock, 1)) {}}
+    ~MarkCacheLock() {__sync_lock_release(&mark_cache_lock);}
+  };
+
+  static const Marks * cache_find(const Mark::Cache & cache, const Marks * from) {
+    for (Mark::Cache::const_iterator i = cache.begin(), e = cache.end(); i != e; ++i) 
+      if (i->first == from) return i->second;
+    return NULL;
+  }
+
+  static const Marks * cache_lookup(const Mark::Cache & cache, const Marks * from) {
+    MarkCacheLock lock;
+    return cache_find(cache, from);
+  }
+
+  static const Marks * cache_insert(Mark::Cache & cache, const Marks * from, const Marks * to) {
+    MarkCacheLock lock;
+    if (const Marks * prev = cache_find(cache, from)) return prev;
+    cache.push_back(Mark::CacheNode(from, to));
+    return to;
+  }
+
   const Marks * add_mark(const Marks * ms, const Mark * m) {
 
     // check if cached
-    for (Mark::Cache::iterator i = m->cache.begin(), e = m->cache.end(); i != e; ++i) 
-      if (i->first == ms) return i->second;
+    if (const Marks * res = cache_lookup(m->cache, ms)) return res;
 
     // create new mark
     unsigned num_marks = ms ? ms->num_marks + 1 : 1;
-    Marks * nms = (Marks *)GC_MALLOC(sizeof(Marks) + sizeof(void *)*num_marks);
+    Marks * nms = (Marks *)GC_MALLOC_CAT(sizeof(Marks) + sizeof(void *)*num_marks, ALLOC_MARK);
     nms->num_marks = num_marks;
     nms->prev = ms;
     unsigned i = 0;
@@ -88,8 +117,7 @@ namespace ast {
     nms->normalized = add_mark_normalized(ms, m, nms);
 
     // return result
-    m->cache.push_back(Mark::CacheNode(ms, nms));
-    return nms;
+    return cache_insert(m->cache, ms, nms);
   }
 
   const NMarks * add_mark_normalized(const Marks * ms, const Mark * m, 
@@ -154,15 +182,11 @@ namespace ast {
     if (!orig->pop()) return fixup->export_to;
 
     fprintf(stderr, "NON SIMPLE CASE\n");
-    for (Mark::Cache::iterator 
-           i = fixup->fixup_cache.begin(), e = fixup->fixup_cache.end(); i != e; ++i) 
-      if (i->first == orig) return i->second;
+    if (const Marks * res = cache_lookup(fixup->fixup_cache, orig)) return res;
     
     const Marks * nms = merge_marks(normalize(orig->pop()), fixup->also_allow, fixup->export_to);
 
-    fixup->fixup_cache.push_back(Mark::CacheNode(orig, nms));
-    
-    return nms;
+    return cache_insert(fixup->fixup_cache, orig, nms);
   }
 
   void Marks::to_string(OStream & o, SyntaxGather * g) const {
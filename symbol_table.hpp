@@ -51,7 +51,8 @@ namespace ast {
 
   struct BaseMark;
   struct Mark : public gc {
-    static unsigned last_id;
+    GC_ALLOC_CATEGORY(ALLOC_MARK)
+    static unsigned last_id; // shared by all threads as ids are ordered
     unsigned id;
     const SymbolNode * env;
     const BaseMark * base_mark;
@@ -87,7 +88,7 @@ namespace ast {
 
   inline Mark::Mark(const SymbolNode * e, bool d,
                     const NMarks * t, const NMarks * a) 
-    : id(last_id++), env(e), 
+    : id(__sync_fetch_and_add(&last_id, 1)), env(e), 
       base_mark(static_cast<const BaseMark *>(this)), 
       export_tl(d), export_to(t), also_allow(a) 
   {add_mark(NULL, this);}
@@ -277,7 +278,7 @@ namespace ast {
       }
       o << name();
       if (num != 0)
-        o.printf("$$%u", num);
+        o << "$$" << num;
     }
     bool uniq_name(OStream & o, bool for_external) const {
       if (num == 0 && mangle && where && (!for_external || !where->asm_hidden)) {
@@ -290,7 +291,7 @@ namespace ast {
           o << "$";
       } else {
         asm_name(key, o);
-        o.printf("$$%u", num);
+        o << "$$" << num;
       }
       return num != NPOS;
     }
@@ -395,6 +396,7 @@ namespace ast {
   void add_inner_nss(Environ &);
 
   struct SymbolNode : public gc {
+    GC_ALLOC_CATEGORY(ALLOC_SYMBOL_NODE)
     SymbolKey key;
     typedef TopLevelSymbol * Scope;
     Scope scope;   // Effective scope, NULL if global.  Used primary
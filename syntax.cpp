@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
 
 #include "syntax-t.hpp"
 #include "string_buf.hpp"
@@ -22,6 +23,161 @@ namespace syntax_ns {
   const Leaf SYN_ID("id");
 
   const Syntax * const NO_MATCH = SYN(SYN("@")); // used by expand.cpp
+
+  // Open addressing hash table, the id of a name is one more than
+  // its index in names.  Names used as flags and short tokens (see
+  // intern_str) end up in here.  Constructed on first use since
+  // leaves are also created by static initializers in other files.
+  struct InternTable {
+    Vector<String> names;
+    Vector<unsigned> table; // 0 = empty, otherwise id
+    unsigned mask;
+    Vector<const Leaf *> leafs; // indexed by id, unmarked only
+    volatile int lock;
+    InternTable() : mask(0), lock(0) {}
+  };
+
+  static InternTable & intern_tbl() {
+    static InternTable tbl;
+    return tbl;
+  }
+
+  // Names are shared between threads as ids are stored in leaves
+  // created by static initializers, so the table is guarded by a
+  // spin lock.
+  struct InternLock {
+    InternTable & t;
+    InternLock(InternTable & t0) : t(t0) {while (__sync_lock_test_and_set(&t.lock, 1)) {}}
+    ~InternLock() {__sync_lock_release(&t.lock);}
+  };
+
+  static inline unsigned long intern_hash(const char * str, unsigned len) {
+    unsigned long h = 0;
+    for (const char * e = str + len; str != e; ++str)
+      h = 5*h + *str;
+    return h;
+  }
+
+  static void intern_grow(InternTable & t) {
+    unsigned sz = t.table.empty() ? 64 : t.table.size() * 2;
+    t.table.clear();
+    t.table.resize(sz, 0);
+    t.mask = sz - 1;
+    for (unsigned id = 1; id <= t.names.size(); ++id) {
+      const String & n = t.names[id - 1];
+      unsigned i = intern_hash(n.begin(), n.size()) & t.mask;
+      while (t.table[i]) i = (i + 1) & t.mask;
+      t.table[i] = id;
+    }
+  }
+
+  // In the order of WellKnownFlag
+  static const char * const WELL_KNOWN_FLAGS[NUM_WELL_KNOWN_FLAGS - 1] = {
+    "auto", "static", "extern", "register", "inline",
+    "const", "volatile", "restrict", "shadow", "__shadow",
+    "same_scope", "outer", "abi", "asm_hidden", "bit-field",
+    "w_snapshot", "__need_snapshot", "__for_ct", "__ct_callback",
+    "__static_constructor", "__constructor__", "export", "typed-parms",
+    "id", "pure"
+  };
+
+  static unsigned intern_name(InternTable & t, const char * str, unsigned len);
+
+  static void intern_init(InternTable & t) {
+    intern_grow(t);
+    for (unsigned i = 0; i != NUM_WELL_KNOWN_FLAGS - 1; ++i) {
+      const char * n = WELL_KNOWN_FLAGS[i];
+      unsigned id = intern_name(t, n, strlen(n));
+      if (id != i + 1) {
+        fprintf(stderr, "well known flag \"%s\" interned as %u\n", n, id);
+        abort();
+      }
+    }
+  }
+
+  // The slot holding the id of the name, or the empty slot where it
+  // would go
+  static unsigned intern_slot(InternTable & t, const char * str, unsigned len) {
+    if (t.table.empty()) intern_init(t);
+    unsigned i = intern_hash(str, len) & t.mask;
+    while (unsigned id = t.table[i]) {
+      const String & n = t.names[id - 1];
+      if (n.size() == len && memcmp(n.begin(), str, len) == 0) break;
+      i = (i + 1) & t.mask;
+    }
+    return i;
+  }
+
+  static unsigned intern_name(InternTable & t, const char * str, unsigned len) {
+    unsigned i = intern_slot(t, str, len);
+    if (unsigned id = t.table[i]) return id;
+    t.names.push_back(String(str, str + len));
+    unsigned id = t.names.size();
+    if (id * 2 > t.table.size())
+      intern_grow(t);
+    else
+      t.table[i] = id;
+    return id;
+  }
+
+  unsigned intern_name(const char * str, unsigned len) {
+    InternTable & t = intern_tbl();
+    InternLock lock(t);
+    return intern_name(t, str, len);
+  }
+
+  unsigned find_name_id(const char * str, unsigned len) {
+    InternTable & t = intern_tbl();
+    InternLock lock(t);
+    return t.table[intern_slot(t, str, len)];
+  }
+
+  // Only leaves without marks are shared, marks are created per
+  // expansion so sharing those would keep every one of them alive.
+  const Leaf * shared_leaf(const SymbolName & n) {
+    if (n.marks || n.name.empty() || n.name.size() > INTERN_STR_MAX) return new Leaf(n);
+    InternTable & t = intern_tbl();
+    InternLock lock(t);
+    unsigned id = intern_name(t, n.name.begin(), n.name.size());
+    if (id >= t.leafs.size()) t.leafs.resize(id + 1, NULL);
+    if (const Leaf * leaf = t.leafs[id]) return leaf;
+    Leaf * leaf = new Leaf(SymbolName(t.names[id - 1]));
+    leaf->name_id_ = id;
+    leaf->shared = true;
+    t.leafs[id] = leaf;
+    return leaf;
+  }
+
+  String intern_str(const char * str, unsigned len) {
+    if (len > INTERN_STR_MAX) return String(str, str + len);
+    InternTable & t = intern_tbl();
+    InternLock lock(t);
+    return t.names[intern_name(t, str, len) - 1];
+  }
+
+  // Free lists of scratch buffers indexed by log2 of the size, the
+  // first slot of a free buffer links to the next one.  The buffers
+  // are uncollectable as a builder may be the only thing pointing to
+  // its parts.
+  static __thread Syntax * * scratch_bufs[32];
+
+  Syntax * * scratch_alloc(unsigned & sz) {
+    unsigned i = 0;
+    while ((1u << i) < sz) ++i;
+    sz = 1u << i;
+    Syntax * * buf = scratch_bufs[i];
+    if (!buf) return (Syntax * *)GC_MALLOC_UNCOLLECTABLE(sz * sizeof(void *));
+    scratch_bufs[i] = (Syntax * *)buf[0];
+    return buf;
+  }
+
+  void scratch_free(Syntax * * buf, unsigned sz) {
+    unsigned i = 0;
+    while ((1u << i) < sz) ++i;
+    memset(buf, 0, sz * sizeof(void *)); // don't keep the parts alive
+    buf[0] = (Syntax *)scratch_bufs[i];
+    scratch_bufs[i] = buf;
+  }
 }
 
 void SyntaxBase::dump_type_info() {
@@ -429,11 +585,11 @@ void SyntaxBase::set_src_from_parts() const {
   //printf("SET SRC FROM PARTS\n");
   // even though the SubStr is empty it might
   // contain useful source info
-  SourceStr s = get_inner_src(str_);
+  SourceStr s = get_inner_src(raw_str());
   if (s.source) {
-    str_ = s;
+    set_str(s);
   } else if (num_parts() > 0) {
-    str_ = part(0)->str();
+    set_str(part(0)->str());
   }
 }
 
@@ -20,6 +20,18 @@ struct ParseInfo {
     : peg(p), cache(c) {}
 };
 
+// Ids of the flags the compiler itself tests for, they are interned
+// first, in this order, so that checking for them is just an id
+// compare.  Keep in sync with WELL_KNOWN_FLAGS in syntax.cpp.
+enum WellKnownFlag {
+  FLAG_AUTO = 1, FLAG_STATIC, FLAG_EXTERN, FLAG_REGISTER, FLAG_INLINE,
+  FLAG_CONST, FLAG_VOLATILE, FLAG_RESTRICT, FLAG_SHADOW, FLAG__SHADOW,
+  FLAG_SAME_SCOPE, FLAG_OUTER, FLAG_ABI, FLAG_ASM_HIDDEN, FLAG_BIT_FIELD,
+  FLAG_W_SNAPSHOT, FLAG_NEED_SNAPSHOT, FLAG_FOR_CT, FLAG_CT_CALLBACK,
+  FLAG_STATIC_CONSTRUCTOR, FLAG_CONSTRUCTOR, FLAG_EXPORT, FLAG_TYPED_PARMS,
+  FLAG_ID, FLAG_PURE, NUM_WELL_KNOWN_FLAGS
+};
+
 namespace syntax_ns {
 
   inline void stop() {}
@@ -152,9 +164,49 @@ namespace syntax_ns {
       : stop(false), source(s), repl(repl) {}
   };
 
+  // Names used by flags are interned so that flags can be found by
+  // comparing ids rather than strings.  An id is never 0.
+  unsigned intern_name(const char * str, unsigned len);
+  static inline unsigned intern_name(const char * str) 
+    {return intern_name(str, strlen(str));}
+  static inline unsigned intern_name(String str) 
+    {return intern_name(str.begin(), str.size());}
+  // As intern_name but never adds the name, returns 0 if it is not
+  // interned.  Used for lookups, as no flag can have such a name.
+  unsigned find_name_id(const char * str, unsigned len);
+  static inline unsigned find_name_id(const char * str) 
+    {return find_name_id(str, strlen(str));}
+  static inline unsigned find_name_id(String str) 
+    {return find_name_id(str.begin(), str.size());}
+
+  // Bit for a name id in the flag summary of a builder, exact for the
+  // well known flags, other ids may share a bit.
+  static inline unsigned flag_bit(unsigned name_id) {return 1u << (name_id & 31);}
+
+  // Returns the shared copy of a short token so that the same
+  // identifier is only allocated once, longer strings are just
+  // copied
+  static const unsigned INTERN_STR_MAX = 32;
+  String intern_str(const char * str, unsigned len);
+  static inline String intern_str(const char * str, const char * e)
+    {return intern_str(str, e - str);}
+
   struct SyntaxBase {
+    GC_ALLOC_CATEGORY(ALLOC_SYNTAX)
     unsigned type_inf; // "type_info" a reserved word
-    mutable SourceStr str_;
+    // The source span is stored as begin + 32-bit length rather than
+    // a SourceStr to keep nodes small, use str() or raw_str() to get
+    // it and set_str() to change it
+    mutable unsigned src_len_;
+    mutable const char * src_begin_;
+    mutable const SourceInfo * src_;
+
+    SubStr src_span() const {return SubStr(src_begin_, src_begin_ + src_len_);}
+    SourceStr raw_str() const {return SourceStr(src_, src_span());}
+    void set_str(const SourceStr & s) const {
+      assert(s.end - s.begin < 0x100000000LL);
+      src_ = s.source; src_begin_ = s.begin; src_len_ = s.end - s.begin;
+    }
 
     void dump_type_info();
 
@@ -210,6 +262,8 @@ namespace syntax_ns {
     inline flags_iterator flags_end() const;
     inline const SymbolName & what(bool special_ok = false) const;
     inline const SymbolName * what_if_normal() const;
+    inline const Leaf * what_leaf() const;
+    inline unsigned what_id() const;
 
     template <typename T> inline T * entity() const;
 
@@ -218,6 +272,8 @@ namespace syntax_ns {
     inline parts_iterator args_begin() const;
     inline parts_iterator args_end()   const;
     inline Syntax * flag(SymbolName n) const;
+    inline Syntax * flag(const char * n) const;
+    inline Syntax * flag(unsigned name_id) const;
 
     String as_string() const;
     inline const SymbolName & as_symbol_name() const;
@@ -225,7 +281,7 @@ namespace syntax_ns {
     inline operator const SymbolName & () const;
     inline const char * operator ~ () const;
     inline SymbolName string_if_simple() const;
-    inline const SourceStr & str() const;
+    inline SourceStr str() const;
 
     // Note: these are only valid for Reparse type
     inline const SymbolName & rwhat() const;
@@ -257,7 +313,7 @@ namespace syntax_ns {
 
   protected:
     SyntaxBase(unsigned tinf, const SourceStr & s = SourceStr()) 
-      : type_inf(tinf), str_(s) {}
+      : type_inf(tinf) {set_str(s);}
   };
 
   struct SemiMutable : public SyntaxBase {
@@ -279,14 +335,22 @@ namespace syntax_ns {
   };
 
   template <typename T>
-  inline Syntax * find_flag(const T * syn, SymbolName n)
+  inline Syntax * find_flag(const T * syn, unsigned name_id)
   {
     // FIXME: Handle marks correctly rather than ignoring them
     for (flags_iterator i = syn->flags_begin(), e = syn->flags_end(); i != e; ++i) 
-      if ((*i)->what().name == n.name) return *i;
+      if ((*i)->what_id() == name_id) return *i;
     return NULL;
   }
 
+  template <typename T>
+  inline Syntax * find_flag(const T * syn, SymbolName n)
+  {
+    if (syn->flags_begin() == syn->flags_end()) return NULL;
+    unsigned id = find_name_id(n.name);
+    return id ? find_flag(syn, id) : NULL;
+  }
+
   struct NoParts : public SyntaxBase {
     mutable Syntax * self; // hack see parts_begin()
 
@@ -343,7 +407,7 @@ namespace syntax_ns {
   static inline PartsInlined * new_parts_inlined(const SourceStr & str, 
                                                  unsigned sz)
   {
-    PartsInlined * syn = (PartsInlined *)GC_MALLOC(sizeof(PartsInlined) + (sz - 1)*sizeof(void *));
+    PartsInlined * syn = (PartsInlined *)GC_MALLOC_CAT(sizeof(PartsInlined) + (sz - 1)*sizeof(void *), ALLOC_SYNTAX);
     new (syn) PartsInlined(str);
     return syn;
   }
@@ -359,7 +423,7 @@ namespace syntax_ns {
 
   inline PartsInlined * PartsInlined::clone() const {
     unsigned sz = num_parts() + num_flags();
-    PartsInlined * syn = (PartsInlined *)GC_MALLOC(sizeof(PartsInlined) + (sz - 1)*sizeof(void *));
+    PartsInlined * syn = (PartsInlined *)GC_MALLOC_CAT(sizeof(PartsInlined) + (sz - 1)*sizeof(void *), ALLOC_SYNTAX);
     new (syn) PartsInlined(*this);
     copy(parts_, parts_ + sz, syn->parts_);
     return syn;
@@ -376,9 +440,9 @@ namespace syntax_ns {
     MapSourceRes res = f(this);
     if (res.stop) return this;
     unsigned sz = num_parts() + num_flags();
-    PartsInlined * syn = (PartsInlined *)GC_MALLOC(sizeof(PartsInlined) + (sz - 1)*sizeof(void *));
+    PartsInlined * syn = (PartsInlined *)GC_MALLOC_CAT(sizeof(PartsInlined) + (sz - 1)*sizeof(void *), ALLOC_SYNTAX);
     new (syn) PartsInlined(*this);
-    syn->str_.source = res.source;
+    syn->src_ = res.source;
     map_source_copy_parts(f, syn->parts_, parts_, sz);
     return syn;
   }
@@ -400,7 +464,7 @@ namespace syntax_ns {
     Syntax * * flags_end_;
 
     void allocate(unsigned sz) {
-      parts_ = parts_end_ = (Syntax * *)GC_MALLOC((sz) * sizeof(void *));
+      parts_ = parts_end_ = (Syntax * *)GC_MALLOC_CAT((sz) * sizeof(void *), ALLOC_SYNTAX);
       flags_ = flags_end_ = parts_ + sz;
     }
 
@@ -479,7 +543,7 @@ namespace syntax_ns {
   // and add_parts_hook, and insure_space
   template <class T>
   struct MutableExternParts : public T {
-    MutableExternParts(unsigned tinf = 0, const SourceStr & str = SourceStr()) : T(tinf, str) {}
+    MutableExternParts(unsigned tinf = 0, const SourceStr & str = SourceStr()) : T(tinf, str), flag_bits_(0) {}
     
     using T::parts_;
     using T::parts_end_;
@@ -494,16 +558,19 @@ namespace syntax_ns {
     void truncate_flags(unsigned sz) {
       assert(sz <= this->num_flags());
       flags_ = flags_end_ - sz;
+      reset_flag_bits();
     }
 
     void invalidate() {
       parts_ = parts_end_ = NULL;
       flags_ = flags_end_ = NULL;
+      flag_bits_ = 0;
     };
 
     void clear() {
       parts_end_ = parts_;
       flags_ = flags_end_;
+      flag_bits_ = 0;
     }
 
     void add_part(Syntax * p) {
@@ -524,11 +591,16 @@ namespace syntax_ns {
       parts_end_ += sz;
     }
 
+    // Only scan for an existing flag when its bit is already set so
+    // that adding k distinct flags is not O(k^2)
     void add_flag(Syntax * p) {
-      if (find_flag(this, p->what())) return;
+      unsigned id = p->what_id();
+      unsigned bit = flag_bit(id);
+      if ((flag_bits_ & bit) && find_flag(this, id)) return;
       insure_space(1);
       flags_--;
       *flags_ = p;
+      flag_bits_ |= bit;
     }
 
     void merge_flags(flags_iterator i, flags_iterator e) {
@@ -547,12 +619,23 @@ namespace syntax_ns {
       insure_space((e - i) - (flags_end_ - flags_));
       flags_ = flags_end_ - sz;
       copy(i, e, flags_);
+      reset_flag_bits();
     }
 
     void set_flags(Syntax * p) {
       set_flags(p->flags_begin(), p->flags_end());
     }
 
+  protected:
+    // Summary of the ids of the flags present, a clear bit means the
+    // flag is not there
+    unsigned flag_bits_;
+
+    void reset_flag_bits() {
+      flag_bits_ = 0;
+      for (flags_iterator i = flags_, e = flags_end_; i != e; ++i)
+        flag_bits_ |= flag_bit((*i)->what_id());
+    }
   };
 
   // "T" must inherate from ???
@@ -589,7 +672,7 @@ namespace syntax_ns {
       while (new_size - alloc_sz + have < need)
         new_size *= 2;
       assert(new_size >= need); // sanity check against overflow
-      Syntax * * buf = (Syntax * *)GC_MALLOC(new_size * sizeof(void *));
+      Syntax * * buf = (Syntax * *)GC_MALLOC_CAT(new_size * sizeof(void *), ALLOC_SYNTAX);
       //printf("XXX %u+%u=%u %u %u\n", 
       //       this->num_parts(), this->num_flags(), 
       //       this->num_parts() + this->num_flags(), need, new_size);
@@ -604,6 +687,98 @@ namespace syntax_ns {
     }
   }
 
+  // Per-thread scratch storage for SyntaxBuilder, buffers are kept
+  // on a free list per power-of-two size so that the temporary part
+  // arrays of nested builders are reused rather than reallocated.
+  // scratch_alloc rounds "sz" up to the size actually allocated.
+  Syntax * * scratch_alloc(unsigned & sz);
+  void scratch_free(Syntax * * buf, unsigned sz);
+
+  template <typename T>
+  struct PartsPooled : public T {
+    PartsPooled(unsigned tinf = 0, const SourceStr & str = SourceStr()) 
+      : T(tinf, str), pool_(NULL), pool_sz_(0) {}
+    // storage is not shared, it is up to the derived class to copy it
+    PartsPooled(const PartsPooled & other) : T(other), pool_(NULL), pool_sz_(0) {}
+    ~PartsPooled() {release();}
+
+    using T::parts_;
+    using T::parts_end_;
+    using T::flags_;
+    using T::flags_end_;
+
+    Syntax * * pool_; // NULL if not using scratch storage
+    unsigned pool_sz_;
+
+    void insure_space(unsigned need);
+    void pooled_copy(const PartsPooled & other);
+    // Moves the parts out of scratch storage into collectable memory,
+    // for a builder that is not on the stack and so may never be
+    // destroyed (the packrat memo in peg.cpp)
+    void unpool();
+    void release() {
+      if (pool_) scratch_free(pool_, pool_sz_);
+      pool_ = NULL;
+    }
+  private:
+    PartsPooled & operator=(const PartsPooled &);
+  };
+  
+  template <class T>
+  void PartsPooled<T>::insure_space(unsigned need) {
+    unsigned have = flags_ - parts_end_;
+    if (have < need) {
+      unsigned alloc_sz = flags_end_ - parts_;
+      assert(alloc_sz > 0);
+      unsigned new_size = alloc_sz * 2;
+      if (new_size - alloc_sz + have < need)
+        new_size = alloc_sz - have + need;
+      Syntax * * buf = scratch_alloc(new_size);
+      unsigned parts_sz = parts_end_ - parts_;
+      unsigned flags_sz = flags_end_ - flags_;
+      copy(parts_, parts_end_, buf);
+      copy(flags_, flags_end_, buf + new_size - flags_sz);
+      release();
+      pool_ = buf;
+      pool_sz_ = new_size;
+      parts_ = buf;
+      parts_end_ = buf + parts_sz;
+      flags_ = buf + new_size - flags_sz;
+      flags_end_ = buf + new_size;
+    }
+  }
+
+  template <class T>
+  void PartsPooled<T>::pooled_copy(const PartsPooled & other) {
+    unsigned sz = other.flags_end_ - other.parts_;
+    Syntax * * buf = scratch_alloc(sz);
+    release();
+    pool_ = buf;
+    pool_sz_ = sz;
+    parts_ = buf;
+    parts_end_ = buf + other.num_parts();
+    flags_end_ = buf + sz;
+    flags_ = flags_end_ - other.num_flags();
+    copy(other.parts_, other.parts_end_, parts_);
+    copy(other.flags_, other.flags_end_, flags_);
+  }
+
+  template <class T>
+  void PartsPooled<T>::unpool() {
+    if (!pool_) return;
+    unsigned parts_sz = parts_end_ - parts_;
+    unsigned flags_sz = flags_end_ - flags_;
+    unsigned sz = parts_sz + flags_sz > 0 ? parts_sz + flags_sz : 1;
+    Syntax * * buf = (Syntax * *)GC_MALLOC(sz * sizeof(void *));
+    copy(parts_, parts_end_, buf);
+    copy(flags_, flags_end_, buf + sz - flags_sz);
+    release();
+    parts_ = buf;
+    parts_end_ = buf + parts_sz;
+    flags_ = buf + sz - flags_sz;
+    flags_end_ = buf + sz;
+  }
+
   struct PartsSeparate : public ExternParts<SemiMutable> {
     typedef ExternParts<SemiMutable> Base;
 
@@ -620,7 +795,7 @@ namespace syntax_ns {
     const PartsSeparate * map_source(F & f) const {
       MapSourceRes res = f(this);
       if (res.stop) return this;
-      PartsSeparate * syn = new PartsSeparate(SourceStr(res.source, str_.begin, str_.end));
+      PartsSeparate * syn = new PartsSeparate(SourceStr(res.source, src_span()));
       syn->map_source_copy_in(f, *this);
       return syn;
     }
@@ -651,31 +826,38 @@ namespace syntax_ns {
     const Expandable * map_source(F & f) const {
       MapSourceRes res = f(this);
       if (res.stop) return this;
-      return new Expandable(SourceStr(res.source,str_.begin, str_.end), *this, f);
+      return new Expandable(SourceStr(res.source, src_span()), *this, f);
     }
   private:
     template <typename F>
     Expandable(const SourceStr & str, const Expandable & other, F & f) 
-      : Base(IS_EXPANDABLE, str) {map_source_copy_in(f, other);}
+      : Base(IS_EXPANDABLE, str) {map_source_copy_in(f, other); reset_flag_bits();}
   };
 
   struct Leaf : public NoParts {
     SymbolName what_;
+    mutable unsigned name_id_; // see name_id()
+    bool shared; // from shared_leaf, must not be changed
     
-    explicit Leaf(const char * n) : NoParts(LEAF_TI), what_(n){}
-    explicit Leaf(String n) : NoParts(LEAF_TI), what_(n) {}
-    explicit Leaf(SymbolName n) : NoParts(LEAF_TI), what_(n) {}
-    explicit Leaf(const SourceStr & str) : NoParts(LEAF_TI, str) {}
+    explicit Leaf(const char * n) : NoParts(LEAF_TI), what_(n), name_id_(), shared() {}
+    explicit Leaf(String n) : NoParts(LEAF_TI), what_(n), name_id_(), shared() {}
+    explicit Leaf(SymbolName n) : NoParts(LEAF_TI), what_(n), name_id_(), shared() {}
+    explicit Leaf(const SourceStr & str) : NoParts(LEAF_TI, str), name_id_(), shared() {}
     Leaf(const char * n, const SourceStr & s) 
-      : NoParts(LEAF_TI, s), what_(n){}
+      : NoParts(LEAF_TI, s), what_(n), name_id_(), shared() {}
     Leaf(String n, const SourceStr & s) 
-      : NoParts(LEAF_TI, s), what_(n) {}
+      : NoParts(LEAF_TI, s), what_(n), name_id_(), shared() {}
     Leaf(SymbolName n, const SourceStr & s) 
-      : NoParts(LEAF_TI, s), what_(n) {}
+      : NoParts(LEAF_TI, s), what_(n), name_id_(), shared() {}
     Leaf(SymbolName n, const SourceStr & s, const char * e)
-      : NoParts(LEAF_TI, SourceStr(s.source, s.begin, e)), what_(n) {}
+      : NoParts(LEAF_TI, SourceStr(s.source, s.begin, e)), what_(n), name_id_(), shared() {}
     Leaf(SymbolName n, const SourceStr & s, const char * b, const char * e)
-      : NoParts(LEAF_TI, SourceStr(s.source, b, e)), what_(n) {}
+      : NoParts(LEAF_TI, SourceStr(s.source, b, e)), what_(n), name_id_(), shared() {}
+
+    unsigned name_id() const {
+      if (!name_id_) name_id_ = intern_name(what_.name);
+      return name_id_;
+    }
 
     Leaf * clone() const {
       return new Leaf(*this);
@@ -683,10 +865,10 @@ namespace syntax_ns {
     template <typename F>
     const Leaf * map_source(F & f) const {
       MapSourceRes res = f(this);
-      if (res.stop || res.source == str_.source)
+      if (res.stop || res.source == src_)
         return this;
       else
-        return new Leaf(what_, SourceStr(res.source, str_.begin, str_.end));
+        return new Leaf(what_, SourceStr(res.source, src_span()));
     }
   };
 
@@ -740,10 +922,10 @@ namespace syntax_ns {
     template <typename F>
     const SynEntity * map_source(F & f) const {
       MapSourceRes res = f(this);
-      if (res.stop || res.source == str_.source)
+      if (res.stop || res.source == src_)
         return this;
       else
-        return new SynEntity(SourceStr(res.source, str_.begin, str_.end), d);
+        return new SynEntity(SourceStr(res.source, src_span()), d);
     }
   };
 
@@ -776,7 +958,7 @@ namespace syntax_ns {
     const Reparse * map_source(F & f) const {
       MapSourceRes res = f(this, repl);
       if (res.stop) return this;
-      SourceStr new_str = str_;
+      SourceStr new_str = raw_str();
       new_str.source = res.source;
       return new Reparse(what_->map_source(f), res.repl, parse_info, 
                          parse_as, origin, outer_, inner_, &new_str);
@@ -942,6 +1124,25 @@ namespace syntax_ns {
     return NULL;
   }
 
+  inline const Leaf * SyntaxBase::what_leaf() const {
+    if (is_leaf()) return as_leaf();
+    if (const Reparse * r = maybe_reparse()) {
+      if (Syntax * r2 = r->instantiate_no_throw())
+        return r2->what_leaf();
+      return NULL;
+    } else if (first_part_simple()) {
+      if (parts_inlined()) return as_parts_inlined()->first_part()->as_leaf();
+      else return as_parts_separate()->first_part()->as_leaf();
+    }
+    return NULL;
+  }
+
+  // 0 if there is no name
+  inline unsigned SyntaxBase::what_id() const {
+    const Leaf * l = what_leaf();
+    return l ? l->name_id() : 0;
+  }
+
   inline const SymbolName & SyntaxBase::what(bool special_ok) const {
     const SymbolName * w = what_if_normal();
     if (w) return *w;
@@ -976,6 +1177,14 @@ namespace syntax_ns {
   inline Syntax * SyntaxBase::flag(SymbolName n) const {
     return find_flag(this, n);
   }
+  inline Syntax * SyntaxBase::flag(const char * n) const {
+    if (!have_flags()) return NULL;
+    unsigned id = find_name_id(n);
+    return id ? find_flag(this, id) : NULL;
+  }
+  inline Syntax * SyntaxBase::flag(unsigned name_id) const {
+    return find_flag(this, name_id);
+  }
 
   inline String SyntaxBase::as_string() const {assert(simple()); return what();}
   inline const SymbolName & SyntaxBase::as_symbol_name() const {assert(simple()); return what();}
@@ -984,9 +1193,9 @@ namespace syntax_ns {
   inline const char * SyntaxBase::operator ~ () const {return ~as_string();}
   inline SymbolName SyntaxBase::string_if_simple() const {return simple() ? what() : SymbolName();}
 
-  inline const SourceStr & SyntaxBase::str() const {
-    if (have_parts() && str_.empty()) set_src_from_parts(); 
-    return str_;
+  inline SourceStr SyntaxBase::str() const {
+    if (have_parts() && src_len_ == 0) set_src_from_parts(); 
+    return raw_str();
   }
 
   inline const SymbolName & SyntaxBase::rwhat() const {return as_reparse()->rwhat();}
@@ -1144,6 +1353,19 @@ namespace syntax_ns {
 
   extern const Syntax * const NO_MATCH;
 
+  // Leaves without any source info are immutable so the same node is
+  // shared for each name, only short names without marks are shared
+  const Leaf * shared_leaf(const SymbolName & n);
+
+  // Sets the source span of p, shared leaves are copied first
+  static inline Syntax * with_str(Syntax * p, const SourceStr & str) {
+    if (p->is_leaf() && p->as_leaf()->shared)
+      p = new Leaf(p->as_leaf()->what_, str);
+    else
+      p->set_str(str);
+    return p;
+  }
+
   static inline const Leaf * new_leaf(const char * n) {
 
     const Leaf * r = NULL;
@@ -1164,13 +1386,13 @@ namespace syntax_ns {
       assert(r->eq(n));
       return r;
     } else {
-      return new Leaf(n);
+      return shared_leaf(n);
     }
   }
 
   static inline const Leaf * new_syntax(const char * n) {return new_leaf(n);}
-  static inline const Leaf * new_syntax(String n) {return new Leaf(n);}
-  static inline Leaf * new_syntax(SymbolName n) {return new Leaf(n);}
+  static inline const Leaf * new_syntax(String n) {return shared_leaf(n);}
+  static inline const Leaf * new_syntax(SymbolName n) {return shared_leaf(n);}
 
   static inline Leaf * new_syntax(const char * n, const SourceStr & str) {return new Leaf(n, str);}
   static inline Leaf * new_syntax(String n, const SourceStr & str) {return new Leaf(n, str);}
@@ -1265,13 +1487,13 @@ namespace syntax_ns {
   static inline Leaf * new_syntax(const Syntax * o, const ast::Marks * m) 
   {
     assert(o->simple());
-    return new_syntax(SymbolName(o->what().name, m), o->str_);
+    return new_syntax(SymbolName(o->what().name, m), o->raw_str());
   }
   
   static inline Leaf * new_syntax(const Syntax * o, const ast::Mark * m, const SourceInfo * s)
   {
     assert(o->simple());
-    return new_syntax(ast::add_mark(o->what(), m), SourceStr(s, o->str_.begin, o->str_.end));
+    return new_syntax(ast::add_mark(o->what(), m), SourceStr(s, o->src_span()));
   }
 
 
@@ -1393,9 +1615,9 @@ namespace syntax_ns {
     return new_syntax(SourceStr(), first, parts, flags);
   }
 
-  struct SyntaxBuilderBase : public MutableExternParts<PartsExpandable<NoOpHooks > > {
+  struct SyntaxBuilderBase : public MutableExternParts<PartsPooled<NoOpHooks > > {
 
-    typedef MutableExternParts<PartsExpandable<NoOpHooks > > Base;
+    typedef MutableExternParts<PartsPooled<NoOpHooks > > Base;
 
     typedef ::TypeInfo<SyntaxBuilderBase> TypeInfo;
 
@@ -1406,40 +1628,35 @@ namespace syntax_ns {
       if (num_flags() > 0) {
         add_part(SYN(SYN("@"), PARTS(), FLAGS(flags_, flags_end_)));
         flags_ = flags_end_;
+        flag_bits_ = 0;
       }
     }
 
-    // after build is called this object should be considered frozen
+    // The parts are copied as the storage is scratch space that is
+    // reused once the builder goes away
     Syntax * build(const SourceStr & str = SourceStr()) const {
       if (alloc_size() <= COPY_THRESHOLD) {
         return new_syntax(str, PARTS(parts_, parts_end_), FLAGS(flags_, flags_end_));
       } else {
-        // note, this doesn't actually copy anything
-        return new PartsSeparate(str, parts_, parts_end_, flags_, flags_end_);
+        PartsSeparate * syn = new PartsSeparate(str);
+        syn->copy_in(parts_, parts_end_, flags_, flags_end_);
+        return syn;
       }
     }
 
-    // after build is called this object should be considered frozen
-    Syntax * build(const SourceStr & str, Syntax * syn) {
+    Syntax * build(const SourceStr & str, Syntax * syn) const {
       if (alloc_size() <= COPY_THRESHOLD) {
         return new_syntax(str, syn, PARTS(parts_, parts_end_), FLAGS(flags_, flags_end_));
       } else {
-        if (flags_ - parts_end_ >= 1) {
-          copy_backward(parts_, parts_end_, parts_end_ + 1);
-          parts_[0] = syn;
-          return new PartsSeparate(str, parts_, parts_end_, flags_, flags_end_);
-        } else {
-          unsigned new_size = alloc_size() + 1;
-          Syntax * * buf = (Syntax * *)GC_MALLOC(new_size * sizeof(void *));
-          unsigned parts_sz = parts_end_ - parts_;
-          unsigned flags_sz = flags_end_ - flags_;
-          copy(parts_, parts_end_, buf + 1); // leave space for new item
-          copy(flags_, flags_end_, buf + new_size - flags_sz);
-          buf[0] = syn;
-          return new PartsSeparate(str, 
-                                   buf, buf + parts_sz + 1, 
-                                   buf + new_size - flags_sz, buf + new_size);
-        }
+        unsigned parts_sz = num_parts() + 1;
+        PartsSeparate * res = new PartsSeparate(str, parts_sz + num_flags());
+        res->parts_end_ = res->parts_ + parts_sz;
+        res->flags_ = res->parts_end_;
+        res->parts_[0] = syn;
+        copy(parts_, parts_end_, res->parts_ + 1);
+        copy(flags_, flags_end_, res->flags_);
+        res->finalize();
+        return res;
       }
     }
 
@@ -1479,7 +1696,7 @@ namespace syntax_ns {
           flags_end_ = data + INIT_SIZE;
           flags_ = flags_end_ - other.num_flags();
         } else {
-          direct_copy(other);
+          pooled_copy(other);
         }
       }
 
@@ -0,0 +1,10 @@
+int add(int x, int y) {return x + y;}
+
+int scale(int x) {return x * 3;}
+
+int twice(int x) {return add(x, x);}
+
+int main() {
+  printf("%d %d\n", twice(4), scale(5));
+  return 0;
+}
@@ -0,0 +1,33 @@
+set -e
+
+# The function body cache, ZL_CACHE_DIR.  A warm run must give the same
+# output as the cold run, and after editing one function only that
+# function's body may be compiled again or change in the output.
+
+rm -rf cache_dir-t1.cache
+export ZL_CACHE_DIR=cache_dir-t1.cache
+
+$ZL cache_dir-t1.c > cache_dir-t1.log
+mv cache_dir-t1.zls cache_dir-t1-cold.zls
+cold=`ls cache_dir-t1.cache | wc -l`
+
+$ZL cache_dir-t1.c >> cache_dir-t1.log
+mv cache_dir-t1.zls cache_dir-t1-warm.zls
+cmp cache_dir-t1-cold.zls cache_dir-t1-warm.zls
+if [ `ls cache_dir-t1.cache | wc -l` != $cold ]; then
+  echo "warm run added to the cache"; exit 1
+fi
+
+sed 's/x \* 3/x * 4/' cache_dir-t1.c > cache_dir-t1-edit.c
+$ZL cache_dir-t1-edit.c >> cache_dir-t1.log
+if [ `ls cache_dir-t1.cache | wc -l` != `expr $cold + 1` ]; then
+  echo "more than the edited body was compiled again"; exit 1
+fi
+sed 's/cache_dir-t1-edit/cache_dir-t1/' cache_dir-t1-edit.zls > cache_dir-t1-edit.norm
+diff cache_dir-t1-cold.zls cache_dir-t1-edit.norm | grep '^[<>]' > cache_dir-t1.diff || true
+if [ `wc -l < cache_dir-t1.diff` != 2 ] || grep -v scale cache_dir-t1.diff; then
+  echo "the edit changed more than one body"; exit 1
+fi
+
+$ZLS cache_dir-t1-edit.zls
+./a.out > cache_dir-t1.out
@@ -0,0 +1,13 @@
+set -e
+
+# The transformers in ct_batch-t1.zl are compiled in a single batch
+# when the first one is used.
+
+ZL_CT_JOBS=1 $ZL ct_batch-t1.zl > ct_batch-t1.log
+n=`grep -c "COMPILE FOR CT" ct_batch-t1.log || true`
+if [ "$n" != 1 ]; then
+  echo "expected one compile time batch, got $n"; exit 1
+fi
+
+$ZLS ct_batch-t1.zls
+./a.out > ct_batch-t1.out
@@ -0,0 +1 @@
+-3 11 16
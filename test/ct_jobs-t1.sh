@@ -0,0 +1,13 @@
+set -e
+
+# Compiling the transformers of ct_batch-t1.zl in one zls process or
+# in several at once must give the same output.
+
+ZL_CT_JOBS=1 $ZL ct_batch-t1.zl > ct_jobs-t1.log
+mv ct_batch-t1.zls ct_jobs-t1-1.zls
+ZL_CT_JOBS=4 $ZL ct_batch-t1.zl >> ct_jobs-t1.log
+mv ct_batch-t1.zls ct_jobs-t1-4.zls
+cmp ct_jobs-t1-1.zls ct_jobs-t1-4.zls
+
+$ZLS ct_jobs-t1-4.zls
+./a.out > ct_jobs-t1.out
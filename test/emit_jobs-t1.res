@@ -0,0 +1 @@
+453
@@ -0,0 +1,24 @@
+set -e
+
+# Emitting the definitions with several workers must give the same
+# output as with one.  300 definitions is more than one chunk of
+# EMIT_CHUNK_SIZE in ast.cpp.  Each chunk starts with fresh line
+# information so only the #lc line directives may differ.
+
+i=0
+while [ $i -lt 300 ]; do
+  echo "int f$i(int x) {return x + $i;}"
+  i=$((i+1))
+done > emit_jobs-t1.c
+printf '%s\n' 'int main() {printf("%d\n", f0(1) + f150(1) + f299(1)); return 0;}' >> emit_jobs-t1.c
+
+ZL_EMIT_JOBS=1 $ZL emit_jobs-t1.c > emit_jobs-t1.log
+mv emit_jobs-t1.zls emit_jobs-t1-1.zls
+ZL_EMIT_JOBS=4 $ZL emit_jobs-t1.c >> emit_jobs-t1.log
+mv emit_jobs-t1.zls emit_jobs-t1-4.zls
+grep -v '^#lc ' emit_jobs-t1-1.zls > emit_jobs-t1-1.norm
+grep -v '^#lc ' emit_jobs-t1-4.zls > emit_jobs-t1-4.norm
+cmp emit_jobs-t1-1.norm emit_jobs-t1-4.norm
+
+$ZLS emit_jobs-t1-4.zls
+./a.out > emit_jobs-t1.out
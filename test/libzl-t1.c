@@ -0,0 +1,91 @@
+/* Uses the C interface in libzl.h: two compiles on one zl_env give
+   the same output, a failing compile reports the error through
+   zl_diagnostics and does not affect the next compile, and
+   zl_compile_to_buf reports the full size and null terminates when
+   the output is truncated.  Run by libzl-t1.sh. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libzl.h"
+
+static const char GOOD[] = "int twice(int x) {return x * 2;}\n";
+static const char BAD[] = "int oops() {return undefined_var;}\n";
+
+struct Output {
+  char * str;
+  size_t size;
+};
+
+static void append(void * data, const char * str, size_t size) {
+  struct Output * o = (struct Output *)data;
+  o->str = (char *)realloc(o->str, o->size + size + 1);
+  memcpy(o->str + o->size, str, size);
+  o->size += size;
+  o->str[o->size] = '\0';
+}
+
+static int compile(zl_env * z, const char * src, struct Output * o) {
+  o->str = NULL;
+  o->size = 0;
+  return zl_compile(z, "libzl-t1-src.c", src, strlen(src), append, o);
+}
+
+int main() {
+  struct Output first, second, third;
+  char small[16];
+  char * big;
+  size_t needed = 0;
+  const char * diag;
+  int ret = 0;
+
+  zl_env * z = zl_env_new(ZL_NO_PRELUDE);
+  if (zl_diagnostics(z)) {
+    printf("env: %s\n", zl_diagnostics(z));
+    return 1;
+  }
+
+  if (compile(z, GOOD, &first) != 0 || compile(z, GOOD, &second) != 0) {
+    printf("compile failed: %s\n", zl_diagnostics(z));
+    return 1;
+  }
+  printf("compile twice: %s\n",
+         strcmp(first.str, second.str) == 0 ? "same" : "differs");
+
+  if (compile(z, BAD, &third) == 0) {
+    printf("bad compile succeeded\n");
+    ret = 1;
+  }
+  diag = zl_diagnostics(z);
+  printf("diagnostics: %s\n",
+         diag && strstr(diag, "undefined_var") ? "names the error" : "missing");
+  free(third.str);
+
+  if (compile(z, GOOD, &third) != 0) {
+    printf("compile after error failed: %s\n", zl_diagnostics(z));
+    return 1;
+  }
+  printf("compile after error: %s\n",
+         strcmp(first.str, third.str) == 0 ? "same" : "differs");
+
+  memset(small, 'x', sizeof(small));
+  zl_compile_to_buf(z, "libzl-t1-src.c", GOOD, strlen(GOOD),
+                    small, sizeof(small), &needed);
+  printf("truncated: needed %s, %s, %s\n",
+         needed == first.size ? "full size" : "wrong size",
+         small[sizeof(small) - 1] == '\0' ? "null terminated" : "not terminated",
+         strncmp(small, first.str, sizeof(small) - 1) == 0 ? "prefix" : "not a prefix");
+
+  big = (char *)malloc(needed + 1);
+  zl_compile_to_buf(z, "libzl-t1-src.c", GOOD, strlen(GOOD),
+                    big, needed + 1, &needed);
+  printf("full buffer: %s\n", strcmp(big, first.str) == 0 ? "same" : "differs");
+
+  free(big);
+  free(first.str);
+  free(second.str);
+  free(third.str);
+  zl_env_free(z);
+  return ret;
+}
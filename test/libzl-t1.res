@@ -0,0 +1,5 @@
+compile twice: same
+diagnostics: names the error
+compile after error: same
+truncated: needed full size, null terminated, prefix
+full buffer: same
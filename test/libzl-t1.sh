@@ -0,0 +1,6 @@
+set -e
+
+# The C interface in libzl.h, see libzl-t1.c.
+
+${CC:-gcc} -I.. -o a.out libzl-t1.c ../libzl.so -Wl,-rpath,..
+./a.out > libzl-t1.out
@@ -0,0 +1,6 @@
+twice 7 = 14
+thrice 7 = 21
+X get = 1
+Y get = 2
+twice 7 = 14
+thrice 7 = 21
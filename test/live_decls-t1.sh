@@ -0,0 +1,26 @@
+set -e
+
+# Declarations nothing uses are left out of the output, check that
+# the ones still needed are kept: exported symbols only used from
+# another file and things only reached through an initializer or a
+# vtable.  Then check that ZL_KEEP_DECLS keeps everything.
+
+$ZL live_decls-t1a.c > live_decls-t1.log
+$ZL live_decls-t1b.c >> live_decls-t1.log
+$ZL live_decls-t1c.cpp >> live_decls-t1.log
+if grep -q unused_helper live_decls-t1a.zls; then
+  echo "unused_helper not pruned"; exit 1
+fi
+
+$ZLS live_decls-t1a.zls live_decls-t1b.zls
+./a.out > live_decls-t1.out
+$ZLS live_decls-t1c.zls
+./a.out >> live_decls-t1.out
+
+ZL_KEEP_DECLS=1 $ZL live_decls-t1a.c >> live_decls-t1.log
+if ! grep -q unused_helper live_decls-t1a.zls; then
+  echo "unused_helper pruned with ZL_KEEP_DECLS set"; exit 1
+fi
+
+$ZLS live_decls-t1a.zls live_decls-t1b.zls
+./a.out >> live_decls-t1.out
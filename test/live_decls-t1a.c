@@ -0,0 +1,23 @@
+// Nothing in this file uses these, only live_decls-t1b.c does.
+
+static int twice(int x) {return x * 2;}
+static int thrice(int x) {return x * 3;}
+
+// The functions above are only reached through this initializer
+struct Op {
+  const char * name;
+  int (*fun)(int);
+};
+static struct Op ops[2] = {{"twice", (int (*)(int))twice},
+                          {"thrice", (int (*)(int))thrice}};
+
+static int unused_helper(int x) {return x + 1;}
+
+int num_ops = 2;
+
+int apply_op(int i, int x) {
+  int (*fun)(int) = ops[i].fun;
+  return fun(x);
+}
+
+const char * op_name(int i) {return ops[i].name;}
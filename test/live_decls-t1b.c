@@ -0,0 +1,12 @@
+#include <stdio.h>
+
+extern int num_ops;
+int apply_op(int i, int x);
+const char * op_name(int i);
+
+int main() {
+  int i;
+  for (i = 0; i < num_ops; ++i)
+    printf("%s 7 = %d\n", op_name(i), apply_op(i, 7));
+  return 0;
+}
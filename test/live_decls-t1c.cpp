@@ -0,0 +1,21 @@
+#include <stdio.h>
+
+// Y::get is only called through the vtable of Y
+
+class X {
+public:
+  virtual int get() {return 1;}
+};
+
+class Y : public X {
+public:
+  int get() {return 2;}
+};
+
+int main() {
+  X * x = new X;
+  printf("X get = %d\n", x->get());
+  x = new Y;
+  printf("Y get = %d\n", x->get());
+  return 0;
+}
@@ -0,0 +1,149 @@
+// Parses the same files in two threads at once and checks that the
+// result is the same as when they are parsed alone, see the rules
+// above parse_prod in peg.hpp.  Then expands the last file in two
+// separate environments, one after the other, and checks that the
+// two compile the same.  Run by parse_threads.sh.
+
+#include <pthread.h>
+#include <stdio.h>
+
+#include "config.h"
+#include "peg.hpp"
+#include "parse_op.hpp"
+#include "string_buf.hpp"
+#include "error.hpp"
+#include "ast.hpp"
+#include "expand.hpp"
+
+static const unsigned NUM_THREADS = 2;
+static const unsigned ROUNDS = 20;
+
+static const PEG * peg;
+static Vector<SourceFile *> files;
+
+static String parse_all() {
+  StringBuf buf;
+  for (unsigned i = 0; i != files.size(); ++i) {
+    const Syntax * res = parse_str("TOP", SourceStr(files[i]), ParseInfo(peg));
+    res->to_string(buf);
+    buf << "\n";
+  }
+  return buf.freeze();
+}
+
+struct ThreadRes {
+  pthread_t thread;
+  Vector<String> res;
+  String error;
+};
+
+static void * parse_thread(void * data) {
+  ThreadRes * r = (ThreadRes *)data;
+  try {
+    for (unsigned i = 0; i != ROUNDS; ++i)
+      r->res.push_back(parse_all());
+  } catch (Error * err) {
+    r->error = err->message();
+  }
+  return NULL;
+}
+
+static void parse_maps(SourceFile * code, ast::Environ & env) {
+  SourceStr str(code);
+  parse_prod("S_SPACING", str, ParseInfo(env.peg), &env);
+  while (!str.empty()) {
+    const Syntax * p = parse_prod("SEXP", str, ParseInfo(env.peg), &env);
+    parse_prod("S_SPACING", str, ParseInfo(env.peg), &env);
+    read_macro(p, env);
+  }
+}
+
+static String compile_env(ast::Environ & env) {
+  StringBuf * buf = new StringBuf();
+  ast::CompileWriter out;
+  out.open("parse_threads.zls", buf);
+  ast::compile(env.top_level_symbols, out);
+  out.flush();
+  String res = buf->freeze();
+  out.close();
+  return res;
+}
+
+struct Env {
+  ast::Environ env;
+  UniqCounters counters;
+  Env(PEG * p) : env(ast::TOPLEVEL, p), counters() {}
+  // the counters are per thread, so swap in the ones for this
+  // environment like a new compile would
+  void parse(SourceFile * code) {
+    uniq_counters = counters;
+    ast::parse_stmts(SourceStr(code), env);
+    counters = uniq_counters;
+  }
+};
+
+// Both environments are live at once and the statements of each are
+// parsed in turn so any state shared between them shows up as a
+// difference in the output
+static int expand_twice() {
+  PEG * p = parse_peg(SOURCE_PREFIX "grammer.in");
+  SourceFile * maps = new_source_file(SOURCE_PREFIX "grammer.ins");
+  SourceFile * prelude = new_source_file(SOURCE_PREFIX "prelude.zlh");
+  Env e1(p), e2(p);
+  ast::Environ & env1 = e1.env, & env2 = e2.env;
+  parse_maps(maps, env1);
+  parse_maps(maps, env2);
+  e1.parse(prelude);
+  e2.parse(prelude);
+  e1.parse(files.back());
+  e2.parse(files.back());
+  String res1 = compile_env(env1);
+  String res2 = compile_env(env2);
+  if (res1 != res2) {
+    fprintf(stderr, "separate environments differ\n");
+    return 1;
+  }
+  printf("expanded 1 file in 2 environments\n");
+  return 0;
+}
+
+int main(int argc, char * argv[]) {
+  String expect;
+  try {
+    parse_exp_->init();
+    peg = parse_peg(SOURCE_PREFIX "grammer.in");
+    for (int i = 1; i < argc; ++i)
+      files.push_back(new_source_file(argv[i]));
+    expect = parse_all();
+  } catch (Error * err) {
+    fprintf(stderr, "%s\n", ~err->message());
+    return 1;
+  }
+
+  ThreadRes threads[NUM_THREADS];
+  for (unsigned t = 0; t != NUM_THREADS; ++t)
+    pthread_create(&threads[t].thread, NULL, parse_thread, &threads[t]);
+  int ret = 0;
+  for (unsigned t = 0; t != NUM_THREADS; ++t) {
+    ThreadRes & r = threads[t];
+    pthread_join(r.thread, NULL);
+    if (r.error.defined()) {
+      fprintf(stderr, "thread %u: %s\n", t, ~r.error);
+      ret = 1;
+    }
+    for (unsigned i = 0; i != r.res.size(); ++i) {
+      if (r.res[i] != expect) {
+        fprintf(stderr, "thread %u: round %u differs\n", t, i);
+        ret = 1;
+      }
+    }
+  }
+  printf("parsed %d files %u times in %u threads\n", argc - 1, ROUNDS, NUM_THREADS);
+  try {
+    ret |= expand_twice();
+  } catch (Error * err) {
+    fprintf(stderr, "%s\n", ~err->message());
+    ret = 1;
+  }
+  return ret;
+}
@@ -0,0 +1,5 @@
+set -e
+
+${CXX:-g++} -I.. -DNO_GC -o parse_threads parse_threads.cpp ../libzl.so \
+  -Wl,-rpath,.. -lpthread
+./parse_threads ../prelude.zlh ../prelude.zl ../class.zl test11.c > parse_threads.log
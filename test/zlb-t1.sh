@@ -0,0 +1,18 @@
+set -e
+
+# Round trip through the binary form, "zl -s" on the .zlb should give
+# the same result as on the .zls except for the source positions and
+# layout, which the binary form does not keep.
+
+$ZL test11.c > zlb-t1.log
+$ZL -b test11.c >> zlb-t1.log
+
+$ZL -s test11.zls >> zlb-t1.log
+$ZL -s test11.zlb >> zlb-t1.log
+
+norm() {
+  grep -v '^#' $1 | sed 's/ # [^ ]*$//' | tr -d ' \n'
+}
+norm test11.zls.zls > zlb-t1.zls.norm
+norm test11.zlb.zls > zlb-t1.zlb.norm
+cmp zlb-t1.zls.norm zlb-t1.zlb.norm
@@ -59,21 +59,22 @@ namespace ast {
     enum Mode {ZLS_MODE, ZL_MODE} mode;
     bool kill_const;
     GenericPrintInst(Mode m = ZL_MODE) : mode(m), kill_const(false) {}
-    void to_string(const TypeInst &, StringBuf & buf) const;
     void declaration(String var, const TypeInst &, StringBuf & buf) const;
+  protected:
+    bool to_string_i(const TypeInst &, StringBuf & buf) const;
   private:
-    void to_string0(const TypeInst &, StringBuf & buf, bool keep_const = true) const;
+    bool to_string0(const TypeInst &, StringBuf & buf, bool keep_const = true) const;
   };
 
   class CPrintInst : public PrintInst { 
   public:
     enum Mode {C_MODE, ZL_MODE} mode;
     CPrintInst(Mode m = C_MODE) : mode(m) {}
-    void to_string(const TypeInst &, StringBuf & buf) const;
-    void declaration(String var, const TypeInst & t, StringBuf & buf, bool parentheses) const;
-    void declaration(String var, const TypeInst & t, StringBuf & buf) const {
-      declaration(var, t, buf, false);
-    }
+    void declaration(String var, const TypeInst & t, StringBuf & buf) const;
+  protected:
+    bool to_string_i(const TypeInst &, StringBuf & buf) const;
+  private:
+    bool declaration0(String var, const TypeInst & t, StringBuf & buf, bool parentheses = false) const;
   };
 
   class ZLPrintInst : public CPrintInst { 
@@ -98,8 +99,9 @@ namespace ast {
 
   class ManglePrintInst : public PrintInst { 
   public:
-    void to_string(const TypeInst &, StringBuf & buf) const;
     void declaration(String var, const TypeInst & t, StringBuf & buf) const;
+  protected:
+    bool to_string_i(const TypeInst &, StringBuf & buf) const;
   };
 
   PrintInst const * const generic_print_inst = new GenericPrintInst();
@@ -109,16 +111,54 @@ namespace ast {
   PrintInst const * const zls_kill_const_print_inst = new ZLSKillConstPrintInst();
   PrintInst const * const zle_print_inst = new ZLEPrintInst();
   PrintInst const * const mangle_print_inst = new ManglePrintInst();
+
+  // A declaration is cached as the text before and after the name
+  struct PrintedType : public gc {
+    const PrintInst * pi;
+    bool decl;
+    String str;
+    String after; // only used for declarations
+    PrintedType * next;
+    PrintedType(const PrintInst * p, bool d, String s, String a, PrintedType * n)
+      : pi(p), decl(d), str(s), after(a), next(n) {}
+  };
+
+  static inline PrintedType * find_printed(const TypeInst & type, const PrintInst * pi, bool decl) {
+    for (PrintedType * cur = type.printed; cur; cur = cur->next)
+      if (cur->pi == pi && cur->decl == decl) return cur;
+    return NULL;
+  }
+
+  bool PrintInst::to_string(const TypeInst & type, StringBuf & buf) const {
+    if (PrintedType * p = find_printed(type, this, false)) {
+      buf << p->str;
+      return true;
+    }
+    unsigned start = buf.size();
+    bool stable = to_string_i(type, buf);
+    // only finalized types are immutable
+    if (stable && type.exact_type)
+      type.printed = new PrintedType(this, false, String(buf.data() + start, buf.data() + buf.size()), 
+                                     String(), type.printed);
+    return stable;
+  }
+
+  String PrintInst::to_string(const TypeInst & type) const {
+    if (PrintedType * p = find_printed(type, this, false))
+      return p->str;
+    StringBuf buf;
+    to_string(type, buf);
+    return buf.freeze();
+  }
   
-  void TypeParm::to_string(const PrintInst & pi, StringBuf & buf) const {
+  bool TypeParm::to_string(const PrintInst & pi, StringBuf & buf) const {
     switch (what) {
     case NONE:
       buf << "<none>";
       break;
     case TYPE:
     case TUPLE:
-      pi.to_string(*as_type, buf);
-      break;
+      return pi.to_string(*as_type, buf);
     case INT:
       buf.printf("%d", as_int);
       break;
@@ -132,6 +172,7 @@ namespace ast {
       abort();
       break;
     }
+    return true;
   }
 
   bool operator==(const TypeInst & lhs, const Vector<TypeParm> & rhs) {
@@ -153,8 +194,9 @@ namespace ast {
     return true;
   }
 
-  void GenericPrintInst::to_string0(const TypeInst & type0, StringBuf & buf, bool keep_const) const {
+  bool GenericPrintInst::to_string0(const TypeInst & type0, StringBuf & buf, bool keep_const) const {
     bool zls_mode = mode == ZLS_MODE;
+    bool stable = true;
     const TypeInst * type = &type0;
     for (;;) { // loop while something changed
       if (const ZeroT * t = dynamic_cast<const ZeroT *>(type)) {
@@ -162,6 +204,7 @@ namespace ast {
       } else if (const WrapperTypeInst * t = dynamic_cast<const WrapperTypeInst *>(type)) {
         type = t->of;
       } else if (const UserType * t = zls_mode ? dynamic_cast<const UserType *>(type) : NULL) {
+        if (!t->defined) stable = false;
         type = t->type;
       } else {
         break;
@@ -173,7 +216,10 @@ namespace ast {
         buf << tag << " ";
       }
       buf << type->type_symbol->uniq_name();
+      if (!type->type_symbol->uniq_name_.defined()) stable = false;
     } else if (const Tuple * t = dynamic_cast<const Tuple *>(type)) {
+      // the parameter symbols are filled in later
+      stable = false;
       buf << ".";
       for (unsigned i = 0; i < t->parms.size();) {
         buf << " (";
@@ -187,28 +233,30 @@ namespace ast {
 	buf << " ...";
       }
     } else if (const QualifiedType * t = dynamic_cast<const QualifiedType *>(type)) {
-      to_string0(*t->subtype, buf);
+      stable &= to_string0(*t->subtype, buf);
       if (t->qualifiers & QualifiedType::CONST && keep_const)  buf += " :const";
       if (t->qualifiers & QualifiedType::VOLATILE)             buf += " :volatile";
       if (t->qualifiers & QualifiedType::RESTRICT)             buf += " :restrict";
     } else if (const Reference * t = zls_mode ? dynamic_cast<const Reference *>(type) : NULL) {
       buf += ".ptr ";
-      to_string(*t->subtype, buf);
+      stable &= to_string(*t->subtype, buf);
     } else {
       buf += type->type_symbol->name();
       for (unsigned i = 0;;) {
         buf += " ";
-        type->parm(i).to_string(*this, buf);
+        stable &= type->parm(i).to_string(*this, buf);
         ++i;
         if (i == sz) break;
       }
     }
+    return stable;
   }
 
-  void GenericPrintInst::to_string(const TypeInst & type, StringBuf & buf) const {
+  bool GenericPrintInst::to_string_i(const TypeInst & type, StringBuf & buf) const {
     buf << "(";
-    to_string0(type, buf, !kill_const);
+    bool stable = to_string0(type, buf, !kill_const);
     buf << ")";
+    return stable;
   }
 
   void GenericPrintInst::declaration(String var, const TypeInst & type, StringBuf & buf) const {
@@ -217,7 +265,7 @@ namespace ast {
     buf << ")";
   }
 
-  void ManglePrintInst::to_string(const TypeInst & type0, StringBuf & buf) const {
+  bool ManglePrintInst::to_string_i(const TypeInst & type0, StringBuf & buf) const {
     // $s: "struct X"
     // $e: "enum X"
     // $c: "class X" (unused)
@@ -243,29 +291,31 @@ namespace ast {
     if (sz == 0) {
       if (const char * tag = type->tag()) {
         buf << "$" << tag[0]; // $s, $e, $c, or $u
-        type->type_symbol->uniq_name(buf, true);
+        return type->type_symbol->uniq_name(buf, true);
       } else {
         StringBuf tmp;
-        type->type_symbol->uniq_name(tmp, true);
+        bool stable = type->type_symbol->uniq_name(tmp, true);
         bool dash = false;
         for (unsigned i = 0; i != tmp.size(); ++i) {
           if (tmp[i] == '-') {tmp[i] = '_'; dash = true;}
         }
         buf << (dash ? "$b" : "$_") << tmp.freeze();
+        return stable;
       }
     } else if (const QualifiedType * t = dynamic_cast<const QualifiedType *>(type)) {
       if (t->qualifiers & QualifiedType::CONST)    buf += "$C";
       if (t->qualifiers & QualifiedType::VOLATILE) buf += "$v";
       if (t->qualifiers & QualifiedType::RESTRICT) buf += "$r";
-      to_string(*t->subtype, buf);
+      return to_string(*t->subtype, buf);
     } else if (const PointerLike * t = dynamic_cast<const PointerLike *>(type)) {
       buf += "$P";
-      to_string(*t->subtype, buf);
+      return to_string(*t->subtype, buf);
     } else if (const Reference * t = dynamic_cast<const Reference *>(type)) {
       buf += "$R";
-      to_string(*t->subtype, buf);
+      return to_string(*t->subtype, buf);
     } else {
       buf += "$U";
+      return true;
     }
   }
 
@@ -273,12 +323,35 @@ namespace ast {
     abort();
   }
 
-  void CPrintInst::to_string(const TypeInst & type, StringBuf & buf) const {
-    declaration("", type, buf);
+  bool CPrintInst::to_string_i(const TypeInst & type, StringBuf & buf) const {
+    return declaration0("", type, buf);
+  }
+
+  void CPrintInst::declaration(String var, const TypeInst & type, StringBuf & buf) const {
+    if (var.empty()) {
+      to_string(type, buf);
+      return;
+    }
+    PrintedType * p = find_printed(type, this, true);
+    if (!p) {
+      static const char VAR_SLOT[] = "\x01";
+      StringBuf tmp;
+      const char * slot = NULL;
+      if (declaration0(VAR_SLOT, type, tmp) && type.exact_type)
+        slot = (const char *)memchr(tmp.data(), VAR_SLOT[0], tmp.size());
+      if (!slot) {
+        declaration0(var, type, buf);
+        return;
+      }
+      p = type.printed = new PrintedType(this, true, String(tmp.data(), slot), 
+                                         String(slot + 1, tmp.data() + tmp.size()), type.printed);
+    }
+    buf << p->str << var << p->after;
   }
 
-  void CPrintInst::declaration(String var, const TypeInst & type0, StringBuf & buf, bool parentheses) const {
+  bool CPrintInst::declaration0(String var, const TypeInst & type0, StringBuf & buf, bool parentheses) const {
     const Type * type = &type0;
+    bool stable = true;
     String qualifiers;
     for (;;) { // loop while something changed
       if (const ZeroT * t = dynamic_cast<const ZeroT *>(type)) {
@@ -293,12 +366,15 @@ namespace ast {
       } else if (const WrapperTypeInst * t = dynamic_cast<const WrapperTypeInst *>(type)) {
         type = t->of;
       } else if (const UserType * t = dynamic_cast<const UserType *>(mode == C_MODE ? type : NULL)) {
+        if (!t->defined) stable = false;
         type = t->type;
       } else {
         break;
       }
     }
     if (const Tuple * t = dynamic_cast<const Tuple *>(type)) {
+      // the parameter symbols are filled in later
+      stable = false;
       buf << "(";
       for (unsigned i = 0; i < t->parms.size();) {
         declaration(t->parms[i].sym ? t->parms[i].sym->uniq_name() : t->parms[i].name.name, 
@@ -319,27 +395,28 @@ namespace ast {
       lbuf << "*" << qualifiers;
       if (!var.empty())
         lbuf << " " << var;
-      declaration(lbuf.freeze(), *t->subtype, buf, true);
+      stable &= declaration0(lbuf.freeze(), *t->subtype, buf, true);
     } else if (const Reference * t = dynamic_cast<const Reference *>(type)) {
       StringBuf lbuf;
       lbuf << (mode == C_MODE ? "*" : "&") << qualifiers;
       if (!var.empty())
         lbuf << " " << var;
-      declaration(lbuf.freeze(), *t->subtype, buf, true);
+      stable &= declaration0(lbuf.freeze(), *t->subtype, buf, true);
     } else if (const Array * t = dynamic_cast<const Array *>(type)) {
       assert(qualifiers.empty());
       StringBuf lbuf;
       if (parentheses) lbuf << "(" << var << ")";
       else             lbuf << var;
       lbuf.printf("[%d]", t->length);
-      declaration(lbuf.freeze(), *t->subtype, buf);
+      stable &= declaration0(lbuf.freeze(), *t->subtype, buf);
     } else if (const Function * t = dynamic_cast<const Function *>(type)) {
       assert(qualifiers.empty());
       StringBuf lbuf;
       if (parentheses) lbuf << "(" << var << ")";
       else             lbuf << var;
-      declaration("", *t->parms, lbuf);
-      declaration(lbuf.freeze(), *t->ret, buf);
+      declaration0("", *t->parms, lbuf);
+      stable = false;
+      declaration0(lbuf.freeze(), *t->ret, buf);
     } else if (type->num_parms() == 0) {
       if (const char * tag = type->tag()) {
         buf << tag << " ";
@@ -349,12 +426,14 @@ namespace ast {
       unsigned e = buf.size();
       for (; i != e; ++i)
         if (buf[i] == '-') buf[i] = ' ';
+      if (!type->type_symbol->uniq_name_.defined()) stable = false;
       buf << qualifiers;
       if (!var.empty())
 	buf << " " << var;
     } else {
       abort();
     }
+    return stable;
   }
 
   //Type * TypeOfSymbol::inst(Vector<TypeParm> & d) {
@@ -506,9 +585,9 @@ namespace ast {
       parse_type_parms(p->args_begin(), p->args_end(), t, parms, env, in_tuple);
     Type * inst_type = t->inst(parms);
     unsigned qualifiers = 0;
-    if (p->flag("const"))    qualifiers |= QualifiedType::CONST;
-    if (p->flag("volatile")) qualifiers |= QualifiedType::VOLATILE;
-    if (p->flag("restrict")) qualifiers |= QualifiedType::RESTRICT;
+    if (p->flag(FLAG_CONST))    qualifiers |= QualifiedType::CONST;
+    if (p->flag(FLAG_VOLATILE)) qualifiers |= QualifiedType::VOLATILE;
+    if (p->flag(FLAG_RESTRICT)) qualifiers |= QualifiedType::RESTRICT;
     if (qualifiers) {
       Vector<TypeParm> q_parms;
       q_parms.push_back(TypeParm(inst_type));
@@ -572,6 +651,12 @@ namespace ast {
 
   class C_TypeRelation : public TypeRelation {
   public:
+    // set by create_c_types, per relation so that separate
+    // environments each promote to their own int
+    const Int * int_t;
+    const Int * uint_t;
+    C_TypeRelation() : int_t(), uint_t() {}
+    const Int * int_promotion(const Int * x) const;
     TypeConv resolve_to(Exp * exp, const Type * type, Environ & env, CastType rule, CheckOnlyType) const;
     Exp * to_effective(Exp * exp, Environ & env) const;
     Exp * def_arg_prom(Exp * exp, Environ & env) const;
@@ -579,16 +664,13 @@ namespace ast {
     const Type * unify(int rule, const Type *, const Type *, Environ & env) const;
   };
 
-  static const Int * INT;
-  static const Int * UINT;
-
-  static const Int * int_promotion(const Int * x) {
+  const Int * C_TypeRelation::int_promotion(const Int * x) const {
     // 6.3.1.1: Integer promotions
     assert(x->min != x->max);
-    //printf("%lld <= %lld && %llu <= %llu %p %p\n", INT->min, x->min, x->max, INT->max, INT, x);
-    if (INT->min <= x->min && x->max <= INT->max) return INT;
-    //printf("%lld <= %lld && %llu <= %llu %p %p\n", UINT->min, x->min, x->max, UINT->max, UINT, x);
-    if (UINT->min <= x->min && x->max <= UINT->max) return UINT;
+    //printf("%lld <= %lld && %llu <= %llu %p %p\n", int_t->min, x->min, x->max, int_t->max, int_t, x);
+    if (int_t->min <= x->min && x->max <= int_t->max) return int_t;
+    //printf("%lld <= %lld && %llu <= %llu %p %p\n", uint_t->min, x->min, x->max, uint_t->max, uint_t, x);
+    if (uint_t->min <= x->min && x->max <= uint_t->max) return uint_t;
     return x;
   }
 
@@ -912,7 +994,8 @@ namespace ast {
 
   const Int * add_c_int(TypeSymbolTable types, String n);
 
-  void create_c_types(TypeSymbolTable types) {
+  void create_c_types(TypeSymbolTable types, TypeRelation * rel) {
+    C_TypeRelation * c_rel = static_cast<C_TypeRelation *>(rel);
     add_internal_type(types, ".int8", new_signed_int(1));
     add_internal_type(types, ".uint8", new_unsigned_int(1));
     add_internal_type(types, ".int16", new_signed_int(2));
@@ -924,7 +1007,7 @@ namespace ast {
 
     add_c_int(types, "signed-char");
     add_c_int(types, "short");
-    INT = add_c_int(types, "int");
+    c_rel->int_t = add_c_int(types, "int");
     add_c_int(types, "long");
     add_c_int(types, "long-long");
 
@@ -935,7 +1018,7 @@ namespace ast {
 
     add_c_int(types, "unsigned-char");
     add_c_int(types, "unsigned-short");
-    UINT = add_c_int(types, "unsigned-int");
+    c_rel->uint_t = add_c_int(types, "unsigned-int");
     add_c_int(types, "unsigned-long");
     add_c_int(types, "unsigned-long-long");
 
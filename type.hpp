@@ -18,6 +18,7 @@ namespace ast {
   // properties
 
   class PrintInst;
+  struct PrintedType;
   class TypeSymbol;
   class TypeInst;
   typedef TypeInst Type;
@@ -71,7 +72,7 @@ namespace ast {
     explicit TypeParm(What w, const Type * t, SymbolKey n = SymbolKey()) : what(w), as_type(t), name(n) {}
     explicit TypeParm(int i, SymbolKey n = SymbolKey()) : what(INT), as_int(i), name(n) {}
     explicit TypeParm(Exp * exp, SymbolKey n = SymbolKey()) : what(EXP), as_exp(exp), name(n) {}
-    void to_string(const PrintInst &, StringBuf & buf) const;
+    bool to_string(const PrintInst &, StringBuf & buf) const;
     static TypeParm dots() {return TypeParm(DOTS);}
   private:
     explicit TypeParm(What w) : what(w) {}
@@ -140,16 +141,16 @@ namespace ast {
 
   class PrintInst {
   public:
-    virtual void to_string(const TypeInst &, StringBuf & buf) const = 0;
+    // The printed form is cached in the type once it can no longer
+    // change, returns false if it still might
+    bool to_string(const TypeInst &, StringBuf & buf) const;
+    String to_string(const TypeInst & t) const;
     // declaration is needed to handle C types correctly, perhaps this is not 
     // the best place for it
-    String to_string(const TypeInst & t) const {
-      StringBuf buf;
-      to_string(t, buf);
-      return buf.freeze();
-    }
     virtual void declaration(String var, const TypeInst &, StringBuf & buf) const = 0;
     virtual ~PrintInst() {}
+  protected:
+    virtual bool to_string_i(const TypeInst &, StringBuf & buf) const = 0;
   };
 
   extern PrintInst const * const generic_print_inst;
@@ -233,6 +234,7 @@ namespace ast {
 
   class TypeInst {
   public:
+    GC_ALLOC_CATEGORY(ALLOC_TYPE)
     typedef ::TypeInfo<TypeInst> TypeInfo;
     TypeCategory * category;
     TypeSymbol * type_symbol;
@@ -244,13 +246,14 @@ namespace ast {
     bool addressable;
     bool read_only;
     bool is_null;
+    mutable PrintedType * printed; // see PrintInst::to_string
     TypeInst(TypeCategory * c = UNKNOWN_C)
       : category(c), 
-        addressable(false), read_only(false), is_null(false)
+        addressable(false), read_only(false), is_null(false), printed()
       , exact_type() {}
     TypeInst(const TypeInst * p) 
       : category(p->category), 
-        addressable(p->addressable), read_only(p->read_only), is_null(p->is_null)
+        addressable(p->addressable), read_only(p->read_only), is_null(p->is_null), printed()
       , exact_type() {}
     void to_string(StringBuf & buf, const PrintInst * pi = NULL) const 
       {if (pi == NULL) pi = type_symbol->print_inst; pi->to_string(*this, buf);}
@@ -849,7 +852,7 @@ namespace ast {
 
 
   TypeRelation * new_c_type_relation();
-  void create_c_types(TypeSymbolTable types);
+  void create_c_types(TypeSymbolTable types, TypeRelation *);
 
   static inline bool is_ptr_fun(const Type * t) {
     const Pointer * ptr = dynamic_cast<const Pointer *>(t->root);
@@ -1,5 +1,6 @@
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -71,9 +72,9 @@ void pos_to_str(Pos p, OStream & buf) {
   if (p.line == NPOS)
     ;//buf.write(":");
   else if (p.col == NPOS)
-    buf.printf(":%u", p.line);
+    buf << ':' << p.line;
   else
-    buf.printf(":%u:%u", p.line, p.col);
+    buf << ':' << p.line << ':' << p.col;
 }
 
 const BacktraceInfo SourceBlock::PLACEHOLDER(BacktraceInfo::NONE);
@@ -86,67 +87,118 @@ void SourceFile::read(String file) {
     abort();
   }
   read(fd);
+  close(fd);
 }
 
 void SourceFile::read(int fd) {
-  static const unsigned BLOCK_SIZE = 1024*16;
-  char * d = (char *)malloc(BLOCK_SIZE);
-  unsigned capacity = BLOCK_SIZE;
-  size_ = 0;
-  ssize_t s;
-  while (s = ::read(fd, d + size_, BLOCK_SIZE), s) {
-    size_ += s;
-    if (size_ + BLOCK_SIZE > capacity) {
-        capacity *= 2;
-        d = (char *)realloc(d, capacity);
+  if (!map(fd)) {
+    static const unsigned BLOCK_SIZE = 1024*16;
+    char * d = (char *)malloc(BLOCK_SIZE);
+    unsigned capacity = BLOCK_SIZE;
+    size_ = 0;
+    ssize_t s;
+    while (s = ::read(fd, d + size_, BLOCK_SIZE), s) {
+      size_ += s;
+      if (size_ + BLOCK_SIZE > capacity) {
+          capacity *= 2;
+          d = (char *)realloc(d, capacity);
+      }
     }
+    d = (char *)realloc(d, size_+1);
+    d[size_] = '\0';
+    data_ = d;
   }
-  d = (char *)realloc(d, size_+1);
-  d[size_] = '\0';
+  if (pp_mode)
+    find_source_changes();
+  base_block.box = SourceStr(this);
+}
+
+void SourceFile::read(const char * data, unsigned size) {
+  char * d = (char *)malloc(size + 1);
+  memcpy(d, data, size);
+  d[size] = '\0';
   data_ = d;
-  lines_.push_back(data_);
-  bool new_line = true;
-  bool need_push = true;
-  for (char * s = data_; *s; ++s) {
-    if (new_line) {
-      if (pp_mode && *s == '#') {
-        if (s[1] != ' ') continue;
-        SourceChange sc;
-        sc.idx = s; // the idx is the start of the line
-        ++s;
-        sc.lineno = strtoul(s, &s, 10);
-        ++s;
-        assert(*s == '"');
+  size_ = size;
+  if (pp_mode)
+    find_source_changes();
+  base_block.box = SourceStr(this);
+}
+
+// Map regular files directly rather than copying them.  The parser
+// expects the data to be null terminated so this is only done when
+// the file does not end on a page boundary, as then the rest of the
+// last page is guaranteed to be zero.  In pp mode the line control
+// lines get blanked so the mapping is private and writable.
+bool SourceFile::map(int fd) {
+  struct stat st;
+  if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) return false;
+  size_t sz = st.st_size;
+  if (sz == 0 || sz % sysconf(_SC_PAGESIZE) == 0) return false;
+  int prot = pp_mode ? PROT_READ | PROT_WRITE : PROT_READ;
+  void * d = mmap(NULL, sz, prot, MAP_PRIVATE, fd, 0);
+  if (d == MAP_FAILED) return false;
+  data_ = (char *)d;
+  size_ = sz;
+  mapped_ = true;
+  return true;
+}
+
+SourceFile::~SourceFile() {
+  if (!data_) return;
+  if (mapped_) munmap(data_, size_);
+  else free(data_);
+}
+
+// Record and blank out the "# <line> "<file>"" line control lines
+// left by the preprocessor
+void SourceFile::find_source_changes() {
+  const char * prev_end = NULL;
+  hash_set<String> names;
+  char * end = data_ + size_;
+  for (char * s = data_; (s = (char *)memchr(s, '#', end - s)); ++s) {
+    if (s != data_ && s[-1] != '\n') continue;
+    if (s[1] != ' ') continue;
+    SourceChange sc;
+    sc.idx = s; // the idx is the start of the line
+    // if the previous line was also a line control line just
+    // overwrite it
+    bool need_push = !prev_end || sc.idx != prev_end + 1;
+    ++s;
+    sc.lineno = strtoul(s, &s, 10);
+    ++s;
+    assert(*s == '"');
+    ++s;
+    char * begin = s;
+    while (*s && *s != '"') {
+      if (*s == '\\') {
         ++s;
-        char * begin = s;
-        while (*s && *s != '"') {
-          if (*s == '\\') {
-            ++s;
-            assert(*s);
-          }
-          ++s;
-        }
-        assert(*s == '"');
-        sc.file_name = String(begin,s);
-        while (*s && *s != '\n') ++s;
-        if (need_push)
-          source_change.push_back(sc);
-        else
-          source_change.back() = sc;
-        memset((void *)sc.idx, ' ', s - sc.idx); // blank line
-        need_push = false; // if the next line is also a line control
-                           // line just overwrite this one
-      } else if (pp_mode) {
-        need_push = true;
+        assert(*s);
       }
-      new_line = true;
-    } 
-    if (*s == '\n') {
-      lines_.push_back(s+1);
-      new_line = true;
+      ++s;
     }
+    assert(*s == '"');
+    // share the name between all changes to the same file so that
+    // positions can be compared by pointer
+    sc.file_name = *names.insert(String(begin,s)).first;
+    while (*s && *s != '\n') ++s;
+    if (need_push)
+      source_change.push_back(sc);
+    else
+      source_change.back() = sc;
+    memset((void *)sc.idx, ' ', s - sc.idx); // blank line
+    prev_end = s;
+    if (!*s) break;
   }
-  base_block.box = SourceStr(this);
+}
+
+// Build the line index.  Most files never need a position so this is
+// put off until get_pos is first called.  memchr is much faster than
+// a byte at a time loop as it is vectorized by the C library.
+void SourceFile::index_lines() const {
+  lines_.push_back(data_);
+  const char * end = data_ + size_;
+  for (const char * s = data_; (s = (const char *)memchr(s, '\n', end - s)); ++s)
+    lines_.push_back(s+1);
 }
 
 struct SourceChangeLt {
@@ -158,22 +210,48 @@ struct SourceChangeLt {
     {return x.idx < y;}
 };
 
+// Output mostly walks forward through a file, so first check the line
+// of the last position found and the few lines after it before
+// falling back to a binary search.
+unsigned SourceFile::find_line(const char * s) const {
+  unsigned i = last_line_, sz = lines_.size();
+  if (lines_[i] <= s) {
+    for (unsigned n = 0; n != 4; ++n, ++i)
+      if (i + 1 == sz || s < lines_[i+1]) return last_line_ = i;
+  }
+  Vector<const char *>::const_iterator l = upper_bound(lines_.begin(), lines_.end(), s);
+  return last_line_ = l - lines_.begin() - 1;
+}
+
+// Same as find_line but for the line control lines, also remembers
+// the line the last source change is on
+unsigned SourceFile::find_source_change(const char * s) const {
+  unsigned i = last_sc_, sz = source_change.size();
+  if (!(source_change[i].idx <= s && (i + 1 == sz || s < source_change[i+1].idx))) {
+    Vector<SourceChange>::const_iterator sc = upper_bound(source_change.begin(), source_change.end(), 
+                                                          s, SourceChangeLt());
+    i = sc - source_change.begin() - 1;
+  }
+  if (i != last_sc_ || last_sc_line_ == NPOS) {
+    const char * idx = source_change[i].idx;
+    last_sc_line_ = upper_bound(lines_.begin(), lines_.end(), idx) - lines_.begin() - 1;
+    last_sc_ = i;
+  }
+  return i;
+}
+
 Pos SourceFile::get_pos(const char * s) const {
   if (s < data_ || s > data_ + size_ + 1) {
     return Pos(file_name_, NPOS, NPOS);
   }
-  Vector<const char *>::const_iterator l = lower_bound(lines_.begin(), lines_.end(), s);
-  if (*l != s) --l;
-  if (!pp_mode) return Pos(file_name_, l - lines_.begin() + 1, s - *l + 1);
+  if (lines_.empty()) index_lines();
+  unsigned l = find_line(s);
+  if (!pp_mode) return Pos(file_name_, l + 1, s - lines_[l] + 1);
 
-  Vector<SourceChange>::const_iterator sc = lower_bound(source_change.begin(), source_change.end(), 
-                                                        s, SourceChangeLt());
-  if (sc->idx != s) --sc;
-  Vector<const char *>::const_iterator sc_l = lower_bound(lines_.begin(), lines_.end(), sc->idx);
-  if (*sc_l != sc->idx) --sc_l;
-  assert(sc_l <= l);
-  unsigned line_offset = l - sc_l - 1;
-  return Pos(sc->file_name, sc->lineno + line_offset, NPOS);
+  const SourceChange & sc = source_change[find_source_change(s)];
+  assert(last_sc_line_ <= l);
+  unsigned line_offset = l - last_sc_line_ - 1;
+  return Pos(sc.file_name, sc.lineno + line_offset, NPOS);
 }
 
 String add_dir_if_needed(String file, const SourceFile * included_from) {
@@ -206,3 +284,7 @@ SourceFile * new_source_file(int fd, bool pp_mode) {
   return new SourceFile(fd, pp_mode);
 }
 
+SourceFile * new_source_file(String name, const char * data, unsigned size, bool pp_mode) {
+  return new SourceFile(name, data, size, pp_mode);
+}
+
@@ -42,7 +42,7 @@ public:
   //}
 
   void assign(const char * str, unsigned sz) {
-    StringObj * d0 = (StringObj *)GC_MALLOC_ATOMIC(sizeof(StringObj) + sz + 1);
+    StringObj * d0 = (StringObj *)GC_MALLOC_ATOMIC_CAT(sizeof(StringObj) + sz + 1, ALLOC_STRING);
     d0->size = sz;
     memmove(d0->str, str, sz);
     d0->str[sz] = '\0';